@@ -14,103 +14,144 @@
 #include <stack>
 #include <queue>
 #include <random>
+#include <numeric>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // ---------------------------------------------------------------------------------------------------------------------
 
 using namespace std;
 
+// ---------------------------------------------------------------------------------------------------------------------
+
+#ifdef BESTSELLERS_STATS
+# define STATS_COUNT(counter) (m_Stats.counter.add(1))
+# define STATS_COUNT_IF(condition, counter) ((condition) ? m_Stats.counter.add(1) : (void) 0)
+# define STATS_TIME(operation) StatsTimer statsTimer(m_Stats, Stats::operation)
+# define STATS_RAISE(counter, value) (m_Stats.counter.raise(value))
+# define STATS_REHASH(index, ...) do { size_t statsBuckets = (index).bucket_count(); __VA_ARGS__; if ((index).bucket_count() != statsBuckets) STATS_COUNT(m_Rehashes); } while (0)
+#else
+# define STATS_COUNT(counter) ((void) 0)
+# define STATS_COUNT_IF(condition, counter) ((void) 0)
+# define STATS_TIME(operation) ((void) 0)
+# define STATS_RAISE(counter, value) ((void) 0)
+# define STATS_REHASH(index, ...) __VA_ARGS__
+#endif
+
+#ifdef BESTSELLERS_STATS
+/**
+ * @brief Instrumentation counter that const queries running on several threads may bump at once.
+ *
+ * The counter orders no other memory, so relaxed atomic updates suffice; copies take a relaxed snapshot of the value.
+ */
+class StatsCounter {
+public:
+  StatsCounter() : m_Value(0) {}
+  StatsCounter(const StatsCounter &other) : m_Value(other) {}
+  StatsCounter &operator=(const StatsCounter &other) { m_Value.store(other, memory_order_relaxed); return *this; }
+
+  void add(uint64_t value) { m_Value.fetch_add(value, memory_order_relaxed); }
+  void raise(uint64_t value) { for (uint64_t tmp = *this; tmp < value && !(m_Value.compare_exchange_weak(tmp, value, memory_order_relaxed)); ) {} }
+  operator uint64_t() const { return m_Value.load(memory_order_relaxed); }
+
+private:
+  atomic<uint64_t> m_Value;
+};
+#endif
+
 // ---------------------------------------------------------------------------------------------------------------------
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief Template class to manage best-selling products.
+ * @brief Class to manage the tree structure of products.
  *
- * @tparam Product The type of the product being tracked.
+ * Nodes live in a pool and are linked by 32-bit indices (0 stands for no node), released nodes are chained into a free
+ * list and reused together with the capacity of their name buckets. For Product = int on x86-64 a bucket node takes
+ * 64 bytes (one cache line) of one contiguous array, compared to a separately allocated 72-byte node plus a 16-byte
+ * allocator header before. Products are dense IDs (as handed out by ProductTable), so their entries live in a vector
+ * indexed by ID, where an entry with no units sold stands for a product not in the tree.
  */
 template < typename Product >
-struct Bestsellers {
-  /**
-   * @brief Construct a new Bestsellers object.
-   */
-  Bestsellers() : m_Shop() {}
+class ProductTree {
+	  using NodeIndex = uint32_t;
 
-  // -------------------------------------------------------------------------------------------------------------------
+public:
+		/**
+		 * @brief Forward iterator over the products in rank order, yielding (product, units sold) pairs.
+		 */
+	  class RankIterator {
+	  public:
+		  pair<const Product&, size_t> operator*() const { const ProductNode *node = m_Tree->at(m_Node); return {node->m_Names[m_Slot], node->m_Count}; }
 
-	/**
-	 * @brief Get the total number of tracked products.
-	 *
-	 * @return size_t The number of unique products.
-	 */
-  size_t products() const { return m_Shop.get_uniques(); }
+		  RankIterator &operator++()
+		  {
+			  ++m_Rank;
+			  if (++m_Slot < m_Tree->at(m_Node)->m_Names.size()) return *this;
 
-	/**
-	 * @brief Register the sale of a product.
-	 *
-	 * @param p The product being sold.
-	 * @param amount The amount sold.
-	 */
-  void sell(const Product& p, size_t amount) { m_Shop.insert_node(p, amount); }
+			  m_Slot = 0;
+			  for (NodeIndex tmp = m_Tree->at(m_Node)->m_Left; tmp; tmp = m_Tree->at(tmp)->m_Right) m_Path[m_Depth++] = tmp;
+			  m_Node = m_Depth ? m_Path[--m_Depth] : 0;
 
-	/**
-	 * @brief Get the rank of a product based on its sales.
-	 *
-	 * @param p The product whose rank is to be retrieved.
-	 * @return size_t The rank of the product.
-	 */
-  size_t rank(const Product& p) const { return m_Shop.get_rank(p); }
+			  return *this;
+		  }
 
-	/**
-	 * @brief Get the product with the given rank.
-	 *
-	 * @param rank The rank of the product.
-	 * @return const Product& The product with the specified rank.
-	 */
-  const Product& product(size_t rank) const { return m_Shop.get_product(rank); }
+		  bool operator==(const RankIterator &other) const { return m_Rank == other.m_Rank; }
+		  bool operator!=(const RankIterator &other) const { return m_Rank != other.m_Rank; }
 
-	/**
-	 * @brief Get the number of copies sold of the product with the given rank.
-	 *
-	 * @param rank The rank of the product.
-	 * @return size_t The number of copies sold.
-	 */
-  size_t sold(size_t rank) const { return m_Shop.get_sold(rank); }
+		  size_t rank() const { return m_Rank; }
 
-	/**
-	 * @brief Get the total number of copies sold for products in the given rank interval.
-	 *
-	 * @param from The starting rank.
-	 * @param to The ending rank.
-	 * @return size_t The total number of copies sold.
-	 */
-  size_t sold(size_t from, size_t to) const { return (from == to) ? m_Shop.get_sold(from) : m_Shop.get_sold(from, to); }
+	  private:
+		  friend class ProductTree;
 
-  // -------------------------------------------------------------------------------------------------------------------
+		  const ProductTree *m_Tree; NodeIndex m_Node; size_t m_Slot, m_Rank; uint32_t m_Depth; array<NodeIndex, 64> m_Path;
+	  };
 
-	/**
-	 * @brief Get the first rank where the number of copies sold matches the specified rank.
-	 *
-	 * @param r The rank to check.
-	 * @return size_t The first rank with the same number of copies sold.
-	 */
-  size_t first_same(size_t r) const { return m_Shop.first_same_rank(r); }
+#ifdef BESTSELLERS_STATS
+		/**
+		 * @brief Instrumentation counters, collected when BESTSELLERS_STATS is defined.
+		 *
+		 * m_Height is the largest height the tree has reached, which bounds the length of every descent so far, and
+		 * m_Buckets[k] is the number of tie buckets holding between 2^k and 2^(k+1) - 1 products; m_Calls and
+		 * m_Nanoseconds are indexed by Operation. The counters are atomic, so concurrent const queries on a tree nobody
+		 * modifies may be timed. Rehashes are counted by the ProductTable, as the tree does not hash.
+		 */
+	  struct Stats {
+		  enum Operation { INSERT, BATCH, RANK, PRODUCT, SOLD, SOLD_RANGE, OPERATIONS };
 
-	/**
-	 * @brief Get the last rank where the number of copies sold matches the specified rank.
-	 *
-	 * @param r The rank to check.
-	 * @return size_t The last rank with the same number of copies sold.
-	 */
-  size_t last_same(size_t r) const { return m_Shop.last_same_rank(r); }
+		  StatsCounter m_Rotations, m_Allocations, m_Rebuilds, m_Height;
+		  array<size_t, 64> m_Buckets = {};
+		  array<StatsCounter, OPERATIONS> m_Calls, m_Nanoseconds;
+	  };
+#endif
 
-  // -------------------------------------------------------------------------------------------------------------------
+	  ProductTree() : m_Products(), m_Nodes(1), m_Root(0), m_Free(0) {}
 
-	/**
-	 * @brief Class to manage the tree structure of products.
-	 */
-  class ProductTree {
-  public:
-	  ProductTree() : m_Products(), m_Root(nullptr) {}
-	  ~ProductTree() { delete_tree(m_Root); }
+#ifdef BESTSELLERS_STATS
+		/**
+		 * @brief Get the counters collected so far together with the current tie-bucket histogram.
+		 *
+		 * @return Stats The counters.
+		 */
+	  Stats get_stats() const
+	  {
+		  Stats stats = m_Stats;
+		  collect_bucket_sizes(m_Root, stats.m_Buckets);
+
+		  return stats;
+	  }
+#endif
 
   	  // ---------------------------------------------------------------------------------------------------------------
 
@@ -119,22 +160,86 @@ struct Bestsellers {
 		 *
 		 * @return size_t The number of unique products.
 		 */
-	  size_t get_uniques() const { return m_Root->m_SumNames; }
+	  size_t get_uniques() const { return m_Root ? at(m_Root)->m_SumNames : 0; }
+
+  	    /**
+		 * @brief Check whether a product is in the tree.
+		 *
+		 * @param name The product name.
+		 * @return bool True if the product has been sold and not withdrawn.
+		 */
+	  bool contains(const Product &name) const { return static_cast<size_t>(name) < m_Products.size() && m_Products[name].m_Count; }
 
   	    /**
-		 * @brief Insert a product node into the tree.
+		 * @brief Insert a product node into the tree; a sale of no units is ignored.
 		 *
 		 * @param name The product name.
 		 * @param count The number of units sold.
 		 */
 	  void insert_node(const Product &name, size_t count)
 	  {
-		  if (!(m_Products.count(name))) { m_Products.insert({name, count}); m_Root = insert_node(m_Root, name, count); }
-		  else
+		  STATS_TIME(INSERT);
+		  if (!count) return;
+
+		  ProductEntry &entry = get_entry(name);
+		  if (!(entry.m_Count)) { entry.m_Count = count; m_Root = insert_node(m_Root, name, count); }
+		  else { size_t countOld = entry.m_Count; entry.m_Count += count; increment_node(name, countOld, entry.m_Count); }
+	  }
+
+  		/**
+		 * @brief Insert a batch of sales of distinct products into the tree.
+		 *
+		 * The sales are applied in ascending order of the resulting counts, so consecutive updates share most of their root
+		 * paths. A batch touching at least 1 / BATCH_REBUILD of the products instead rebuilds the tree in O(n): the untouched
+		 * buckets are collected in order, merged with the sorted batch and turned into a perfectly balanced tree.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct products and positive amounts.
+		 */
+	  void insert_batch(vector<pair<Product, size_t>> &sales)
+	  {
+		  STATS_TIME(BATCH);
+		  size_t uniques = get_uniques();
+		  for (auto &sale : sales) { if (contains(sale.first)) sale.second += m_Products[sale.first].m_Count; else ++uniques; }
+		  update_batch(sales, uniques);
+	  }
+
+  		/**
+		 * @brief Withdraw a batch of earlier sales of distinct products from the tree, the same way insert_batch() adds them.
+		 *
+		 * Products left with no units sold are removed from the tree.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct tracked products and positive amounts.
+		 */
+	  void remove_batch(vector<pair<Product, size_t>> &sales)
+	  {
+		  STATS_TIME(BATCH);
+		  for (auto &sale : sales)
+		  {
+			  if (!(contains(sale.first)) || sale.second > m_Products[sale.first].m_Count) throw out_of_range("");
+			  sale.second = m_Products[sale.first].m_Count - sale.second;
+		  }
+		  update_batch(sales, get_uniques());
+	  }
+
+  		/**
+		 * @brief Replace the contents of the tree by products given in rank order, building it bottom-up in O(n).
+		 *
+		 * @param ranked The (product name, number of units sold) pairs of distinct products in descending order of the count.
+		 */
+	  void assign_ranked(vector<pair<Product, size_t>> &ranked)
+	  {
+		  STATS_COUNT(m_Rebuilds); m_Products.clear();
+
+		  vector<pair<size_t, vector<Product>>> buckets;
+		  for (const auto &sale : ranked)
 		  {
-			  size_t countOld = m_Products.at(name); m_Products.at(name) += count; size_t countNew = m_Products.at(name);
-			  m_Root = delete_node(m_Root, name, countOld); m_Root = insert_node(m_Root, name, countNew);
+			  get_entry(sale.first).m_Count = sale.second;
+			  if (buckets.empty() || buckets.back().first != sale.second) buckets.emplace_back(sale.second, vector<Product>());
+			  buckets.back().second.push_back(sale.first);
 		  }
+		  reverse(buckets.begin(), buckets.end());
+
+		  m_Nodes.resize(1); m_Free = 0; m_Root = build_tree(buckets, 0, buckets.size());
 	  }
 
   		/**
@@ -145,14 +250,15 @@ struct Bestsellers {
 		 */
 	  size_t get_rank(const Product &name) const
 	  {
-		  if (!(m_Products.count(name))) throw out_of_range("");
+		  STATS_TIME(RANK);
+		  if (!(contains(name))) throw out_of_range("");
 
-		  size_t count = m_Products.at(name), rank = 0; ProductNode *tmp = m_Root;
+		  const ProductEntry &entry = m_Products[name]; size_t count = entry.m_Count, rank = 0; const ProductNode *tmp = at(m_Root);
 		  while (tmp)
 		  {
-			  if (count < tmp->m_Count) { rank += tmp->m_SumNames; if (tmp->m_Left) rank -= tmp->m_Left->m_SumNames; tmp = tmp->m_Left; }
-			  else if (count > tmp->m_Count) tmp = tmp->m_Right;
-			  else { auto it = find(tmp->m_Names.begin(), tmp->m_Names.end(), name); rank += (tmp->m_SumNames - tmp->m_Names.size() + 1) + (it - tmp->m_Names.begin()); if (tmp->m_Left) rank -= tmp->m_Left->m_SumNames; break; }
+			  if (count < tmp->m_Count) { rank += tmp->m_SumNames; if (tmp->m_Left) rank -= at(tmp->m_Left)->m_SumNames; tmp = at(tmp->m_Left); }
+			  else if (count > tmp->m_Count) tmp = at(tmp->m_Right);
+			  else { rank += (tmp->m_SumNames - tmp->m_Names.size() + 1) + entry.m_Slot; if (tmp->m_Left) rank -= at(tmp->m_Left)->m_SumNames; break; }
 		  }
 
 		  return rank;
@@ -166,20 +272,50 @@ struct Bestsellers {
 		 */
 	  const Product& get_product(size_t rank) const
 	  {
-		  if (rank > m_Root->m_SumNames || rank < 1) throw out_of_range("");
+		  STATS_TIME(PRODUCT);
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
 
-		  size_t rankTmp = 0; ProductNode *tmp = m_Root; Product product;
+		  size_t rankTmp = 0; const ProductNode *tmp = at(m_Root); const Product *product = nullptr;
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (rank > rankTmpHigh) { tmp = tmp->m_Left; }
-			  else { product = tmp->m_Names[(rank - rankTmpLow)]; break; }
+			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (rank > rankTmpHigh) { tmp = at(tmp->m_Left); }
+			  else { product = &tmp->m_Names[(rank - rankTmpLow)]; break; }
+		  }
+
+		  return *product;
+	  }
+
+  		/**
+		 * @brief Get an iterator to the product at the specified rank.
+		 *
+		 * The nodes left to visit are kept on a stack (ancestors whose bucket and lower-count subtree follow), so walking
+		 * k products costs O(log n + k).
+		 *
+		 * @param rank The rank of the product, or the number of products plus one for the end iterator.
+		 * @return RankIterator The iterator.
+		 */
+	  RankIterator get_iterator(size_t rank) const
+	  {
+		  if (rank > get_uniques() + 1 || rank < 1) throw out_of_range("");
+
+		  RankIterator it; it.m_Tree = this; it.m_Node = 0; it.m_Slot = 0; it.m_Rank = rank; it.m_Depth = 0;
+		  size_t rankTmp = 0; NodeIndex tmp = (rank <= get_uniques()) ? m_Root : 0;
+		  while (tmp)
+		  {
+			  const ProductNode *node = at(tmp);
+			  size_t rankTmpOld = rankTmp; rankTmp += node->m_SumNames; if (node->m_Left) rankTmp -= at(node->m_Left)->m_SumNames;
+			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - node->m_Names.size() + 1);
+
+			  if (rank < rankTmpLow) { it.m_Path[it.m_Depth++] = tmp; rankTmp = rankTmpOld; tmp = node->m_Right; }
+			  else if (rank > rankTmpHigh) tmp = node->m_Left;
+			  else { it.m_Node = tmp; it.m_Slot = rank - rankTmpLow; break; }
 		  }
 
-		  return m_Products.find(product)->first;
+		  return it;
 	  }
 
   		/**
@@ -190,16 +326,17 @@ struct Bestsellers {
 		 */
 	  size_t get_sold(size_t rank) const
 	  {
-		  if (rank > m_Root->m_SumNames || rank < 1) throw out_of_range("");
+		  STATS_TIME(SOLD);
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
 
-		  size_t rankTmp = 0; ProductNode *tmp = m_Root; size_t sold = 0;
+		  size_t rankTmp = 0; const ProductNode *tmp = at(m_Root); size_t sold = 0;
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (rank > rankTmpHigh) { tmp = tmp->m_Left; }
+			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (rank > rankTmpHigh) { tmp = at(tmp->m_Left); }
 			  else { sold = tmp->m_Count; break; }
 		  }
 
@@ -215,31 +352,32 @@ struct Bestsellers {
 		 */
 	  size_t get_sold(size_t from, size_t to) const
 	  {
-		  if (to > m_Root->m_SumNames || from < 1 || from > to) throw out_of_range("");
+		  STATS_TIME(SOLD_RANGE);
+		  if (to > get_uniques() || from < 1 || from > to) throw out_of_range("");
 
-		  size_t rankTmp = 0; ProductNode *tmp = m_Root; size_t excess = 0;
+		  size_t rankTmp = 0; const ProductNode *tmp = at(m_Root); size_t excess = 0;
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (from < rankTmpLow) { rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (from > rankTmpHigh) { excess += (tmp->m_Count * tmp->m_Names.size()); if (tmp->m_Right) excess += tmp->m_Right->m_SumCounts; tmp = tmp->m_Left; }
-			  else { excess += ((from - rankTmpLow) * tmp->m_Count); if (tmp->m_Right) excess += tmp->m_Right->m_SumCounts; break; }
+			  if (from < rankTmpLow) { rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (from > rankTmpHigh) { excess += (tmp->m_Count * tmp->m_Names.size()); if (tmp->m_Right) excess += at(tmp->m_Right)->m_SumCounts; tmp = at(tmp->m_Left); }
+			  else { excess += ((from - rankTmpLow) * tmp->m_Count); if (tmp->m_Right) excess += at(tmp->m_Right)->m_SumCounts; break; }
 		  }
 
-		  rankTmp = 0; tmp = m_Root;
+		  rankTmp = 0; tmp = at(m_Root);
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (to < rankTmpLow) { excess += (tmp->m_Count * tmp->m_Names.size()); if (tmp->m_Left) excess += tmp->m_Left->m_SumCounts; rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (to > rankTmpHigh) tmp = tmp->m_Left;
-			  else { excess += ((rankTmpHigh - to) * tmp->m_Count); if (tmp->m_Left) excess += tmp->m_Left->m_SumCounts; break; }
+			  if (to < rankTmpLow) { excess += (tmp->m_Count * tmp->m_Names.size()); if (tmp->m_Left) excess += at(tmp->m_Left)->m_SumCounts; rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (to > rankTmpHigh) tmp = at(tmp->m_Left);
+			  else { excess += ((rankTmpHigh - to) * tmp->m_Count); if (tmp->m_Left) excess += at(tmp->m_Left)->m_SumCounts; break; }
 		  }
 
-		  size_t sold = 0; if (m_Root) sold = (m_Root->m_SumCounts - excess);
+		  size_t sold = 0; if (m_Root) sold = (at(m_Root)->m_SumCounts - excess);
 
 		  return sold;
 	  }
@@ -252,16 +390,16 @@ struct Bestsellers {
 		 */
 	  size_t first_same_rank(size_t rank) const
 	  {
-		  if (rank > m_Root->m_SumNames || rank < 1) throw out_of_range("");
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
 
-		  size_t rankTmp = 0; ProductNode *tmp = m_Root; size_t firstSameRank = 0;
+		  size_t rankTmp = 0; const ProductNode *tmp = at(m_Root); size_t firstSameRank = 0;
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (rank > rankTmpHigh) { tmp = tmp->m_Left; }
+			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (rank > rankTmpHigh) { tmp = at(tmp->m_Left); }
 			  else { firstSameRank = rankTmpLow; break; }
 		  }
 
@@ -276,220 +414,3124 @@ struct Bestsellers {
 	 	 */
 	  size_t last_same_rank(size_t rank) const
 	  {
-		  if (rank > m_Root->m_SumNames || rank < 1) throw out_of_range("");
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
 
-		  size_t rankTmp = 0; ProductNode *tmp = m_Root; size_t lastSameRank = 0;
+		  size_t rankTmp = 0; const ProductNode *tmp = at(m_Root); size_t lastSameRank = 0;
 		  while (tmp)
 		  {
-			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= tmp->m_Left->m_SumNames;
+			  size_t rankTmpOld = rankTmp; rankTmp += tmp->m_SumNames; if (tmp->m_Left) rankTmp -= at(tmp->m_Left)->m_SumNames;
 			  size_t rankTmpHigh = rankTmp, rankTmpLow = (rankTmp - tmp->m_Names.size() + 1);
 
-			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = tmp->m_Right; }
-			  else if (rank > rankTmpHigh) { tmp = tmp->m_Left; }
+			  if (rank < rankTmpLow) { rankTmp = rankTmpOld; tmp = at(tmp->m_Right); }
+			  else if (rank > rankTmpHigh) { tmp = at(tmp->m_Left); }
 			  else { lastSameRank = rankTmpHigh; break; }
 		  }
 
 		  return lastSameRank;
 	  }
 
-  private:
+  		/**
+		 * @brief Get the smallest rank whose top-ranked products sold at least the given number of units, in one descent.
+		 *
+		 * @param units The number of units, between 1 and the total number of units sold.
+		 * @return size_t The smallest such rank.
+		 */
+	  size_t get_cover(size_t units) const
+	  {
+		  if (!units || !m_Root || units > at(m_Root)->m_SumCounts) throw out_of_range("");
+
+		  size_t before = 0, rankBefore = 0; const ProductNode *tmp = at(m_Root);
+		  while (true)
+		  {
+			  const ProductNode *right = at(tmp->m_Right); size_t countsRight = right ? right->m_SumCounts : 0, namesRight = right ? right->m_SumNames : 0;
+			  size_t counts = tmp->m_Names.size() * tmp->m_Count;
+
+			  if (units <= before + countsRight) tmp = right;
+			  else if (units <= before + countsRight + counts) return rankBefore + namesRight + (units - before - countsRight + tmp->m_Count - 1) / tmp->m_Count;
+			  else { before += countsRight + counts; rankBefore += namesRight + tmp->m_Names.size(); tmp = at(tmp->m_Left); }
+		  }
+	  }
+
+  		/**
+		 * @brief Count the products that sold at least the given number of units, in one descent.
+		 *
+		 * @param count The number of units sold.
+		 * @return size_t The number of such products.
+		 */
+	  size_t get_at_least(size_t count) const
+	  {
+		  size_t atLeast = 0; const ProductNode *tmp = at(m_Root);
+		  while (tmp)
+		  {
+			  if (tmp->m_Count < count) tmp = at(tmp->m_Right);
+			  else { atLeast += tmp->m_Names.size() + (tmp->m_Right ? at(tmp->m_Right)->m_SumNames : 0); tmp = at(tmp->m_Left); }
+		  }
+
+		  return atLeast;
+	  }
+
+private:
 	  struct ProductNode {
 		  vector<Product> m_Names; size_t m_Count; size_t m_SumNames, m_SumCounts;
-		  ProductNode *m_Left, *m_Right;
-		  size_t m_Height;
+		  NodeIndex m_Left, m_Right;
+		  uint32_t m_Height;
 
-		  ProductNode(Product name, size_t count) { m_Names.push_back(name); m_Count = count; m_Left = m_Right = nullptr; m_Height = 1; m_SumNames = 1; m_SumCounts = m_Count; }
+		  ProductNode() { m_Count = 0; m_Left = m_Right = 0; m_Height = 0; m_SumNames = 0; m_SumCounts = 0; }
 	  };
 
-	  unordered_map<Product, size_t> m_Products; ProductNode *m_Root;
+	  struct ProductEntry {
+		  size_t m_Count; size_t m_Slot;
+	  };
 
-  	   /**
-		* @brief Delete the tree structure recursively.
-		*
-		* @param root The root node to delete.
-		*/
-	  void delete_tree(ProductNode *root) { if (m_Root) { if (root->m_Left) delete_tree(root->m_Left); if (root->m_Right) delete_tree(root->m_Right); delete root; } }
+	  static constexpr size_t BATCH_REBUILD = 4;
+
+	  vector<ProductEntry> m_Products; vector<ProductNode> m_Nodes; NodeIndex m_Root, m_Free;
+
+#ifdef BESTSELLERS_STATS
+	  struct StatsTimer {
+		  Stats &m_Stats; size_t m_Operation; chrono::steady_clock::time_point m_Start;
+
+		  StatsTimer(Stats &stats, size_t operation) : m_Stats(stats), m_Operation(operation), m_Start(chrono::steady_clock::now()) {}
+		  ~StatsTimer() { m_Stats.m_Calls[m_Operation].add(1); m_Stats.m_Nanoseconds[m_Operation].add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_Start).count()); }
+	  };
+
+	  mutable Stats m_Stats;
 
   	   /**
-		* @brief Get the height of a node.
+		* @brief Add the sizes of the tie buckets of a subtree to a power-of-two histogram.
 		*
-		* @param root The node to get the height of.
-		* @return size_t The height of the node.
+		* @param root The root node.
+		* @param buckets The histogram.
 		*/
-	  size_t get_height(ProductNode *root) const { return root ? root->m_Height : 0; }
+	  void collect_bucket_sizes(NodeIndex root, array<size_t, 64> &buckets) const
+	  {
+		  if (!root) return;
 
-  	 /**
-	  * @brief Get the balance factor of a node.
-	  *
-	  * @param root The node to get the balance factor of.
-	  * @return int The balance factor of the node.
-	  */
-	  int get_balance(ProductNode *root) const { return get_height(root->m_Right) - get_height(root->m_Left); }
+		  size_t size = at(root)->m_Names.size(), power = 0;
+		  while (size >>= 1) ++power;
+		  ++buckets[power];
+
+		  collect_bucket_sizes(at(root)->m_Left, buckets); collect_bucket_sizes(at(root)->m_Right, buckets);
+	  }
+#endif
 
   	   /**
-		* @brief Get the node with the minimum value.
+		* @brief Resolve a node index.
 		*
-		* @param root The root node.
-		* @return ProductNode* The node with the minimum value.
+		* @param index The node index.
+		* @return ProductNode* The node, or nullptr for index 0.
 		*/
-	  ProductNode *get_minimum(ProductNode *root) const { return !(root->m_Left) ? root : get_minimum(root->m_Left); }
+	  ProductNode *at(NodeIndex index) { return index ? &m_Nodes[index] : nullptr; }
+	  const ProductNode *at(NodeIndex index) const { return index ? &m_Nodes[index] : nullptr; }
 
   	   /**
-		* @brief Set the height of a node.
+		* @brief Get the entry of a product, growing the entries to cover its ID.
 		*
-		* @param root The node to set the height of.
+		* @param name The product name.
+		* @return ProductEntry& The entry, with no units sold if the product is not in the tree.
 		*/
-	  void set_height(ProductNode *root)
+	  ProductEntry &get_entry(const Product &name)
 	  {
-		  size_t heightLeft = get_height(root->m_Left), heightRight = get_height(root->m_Right);
-		  root->m_Height = (heightRight > heightLeft ? heightRight : heightLeft) + 1;
+		  size_t index = name;
+		  if (index >= m_Products.size()) { STATS_COUNT_IF(index >= m_Products.capacity(), m_Allocations); m_Products.resize(index + 1, {0, 0}); }
+
+		  return m_Products[index];
 	  }
 
   	   /**
-		* @brief Delete the minimum node.
+		* @brief Take a node from the free list, or append a new one to the pool.
 		*
-		* @param root The root node.
-		* @return ProductNode* The new root after deletion.
+		* @param name The product name.
+		* @param count The number of units sold.
+		* @return NodeIndex The index of the new node.
 		*/
-	  ProductNode *delete_minimum(ProductNode *root)
+	  NodeIndex new_node(const Product &name, size_t count)
 	  {
-		  if (!(root->m_Left)) return root->m_Right;
-		  root->m_Left = delete_minimum(root->m_Left);
+		  NodeIndex index = m_Free;
+		  if (index) m_Free = m_Nodes[index].m_Left;
+		  else
+		  {
+			  if (m_Nodes.size() > numeric_limits<NodeIndex>::max()) throw length_error("");
+			  STATS_COUNT_IF(m_Nodes.size() == m_Nodes.capacity(), m_Allocations);
+			  index = m_Nodes.size(); m_Nodes.emplace_back();
+		  }
 
-		  return balance_node(root);
+		  ProductNode *root = at(index);
+		  root->m_Count = count; root->m_Left = root->m_Right = 0; root->m_Height = 1; STATS_RAISE(m_Height, 1);
+		  STATS_COUNT_IF(!(root->m_Names.capacity()), m_Allocations);
+		  m_Products[name].m_Slot = 0; root->m_Names.push_back(name); update_auxiliary_info(root);
+
+		  return index;
 	  }
 
   	   /**
-		* @brief Rotate the tree to the left.
+		* @brief Return an emptied node to the free list, keeping the capacity of its bucket.
 		*
-		* @param root The root node.
-		* @return ProductNode* The new root after rotation.
+		* @param index The index of the node.
+		*/
+	  void release_node(NodeIndex index) { m_Nodes[index].m_Left = m_Free; m_Free = index; }
+
+  	   /**
+		* @brief Move a batch of distinct products to their new counts, either one by one or by rebuilding the tree.
+		*
+		* @param sales The (product name, new number of units sold) pairs; a product with no units sold is removed.
+		* @param uniques The number of products in the tree once the batch is applied, counting the removed ones.
 		*/
-	  ProductNode *rotate_left(ProductNode *root)
+	  void update_batch(vector<pair<Product, size_t>> &sales, size_t uniques)
 	  {
-		  ProductNode *subtreeRight = root->m_Right;
-		  root->m_Right = subtreeRight->m_Left;
-		  subtreeRight->m_Left = root;
-		  set_height(root); set_height(subtreeRight);
-		  update_auxiliary_info(root); update_auxiliary_info(subtreeRight);
+		  sort(sales.begin(), sales.end(), [](const auto &a, const auto &b) { return a.second < b.second; });
 
-		  return subtreeRight;
+		  if (sales.size() * BATCH_REBUILD < uniques)
+		  {
+			  for (const auto &sale : sales)
+			  {
+				  ProductEntry &entry = get_entry(sale.first);
+				  if (!(entry.m_Count)) { entry.m_Count = sale.second; m_Root = insert_node(m_Root, sale.first, sale.second); }
+				  else if (sale.second > entry.m_Count) { size_t countOld = entry.m_Count; entry.m_Count = sale.second; increment_node(sale.first, countOld, sale.second); }
+				  else
+				  {
+					  m_Root = delete_node(m_Root, sale.first, entry.m_Count); entry.m_Count = sale.second;
+					  if (sale.second) m_Root = insert_node(m_Root, sale.first, sale.second);
+				  }
+			  }
+			  return;
+		  }
+
+		  STATS_COUNT(m_Rebuilds);
+		  for (const auto &sale : sales) get_entry(sale.first).m_Count = sale.second;
+
+		  vector<pair<size_t, vector<Product>>> bucketsOld, buckets; collect_buckets(m_Root, bucketsOld); buckets.reserve(bucketsOld.size() + sales.size());
+		  auto it = bucketsOld.begin();
+		  for (const auto &sale : sales)
+		  {
+			  if (!(sale.second)) continue;
+			  for (; it != bucketsOld.end() && it->first <= sale.second; ++it) buckets.push_back(move(*it));
+			  if (buckets.empty() || buckets.back().first != sale.second) buckets.emplace_back(sale.second, vector<Product>());
+			  buckets.back().second.push_back(sale.first);
+		  }
+		  for (; it != bucketsOld.end(); ++it) buckets.push_back(move(*it));
+
+		  m_Nodes.resize(1); m_Free = 0; m_Root = build_tree(buckets, 0, buckets.size());
 	  }
 
   	   /**
-		* @brief Rotate the tree to the right.
+		* @brief Move the buckets of a subtree out in ascending order of the count, without the products whose count changed.
 		*
 		* @param root The root node.
-		* @return ProductNode* The new root after rotation.
+		* @param buckets Receives the non-empty (count, product names) buckets.
 		*/
-	  ProductNode *rotate_right(ProductNode *root)
+	  void collect_buckets(NodeIndex root, vector<pair<size_t, vector<Product>>> &buckets)
 	  {
-		  ProductNode *subtreeLeft = root->m_Left;
-		  root->m_Left = subtreeLeft->m_Right;
-		  subtreeLeft->m_Right = root;
-		  set_height(root); set_height(subtreeLeft);
-		  update_auxiliary_info(root); update_auxiliary_info(subtreeLeft);
+		  if (!root) return;
 
-		  return subtreeLeft;
+		  collect_buckets(at(root)->m_Left, buckets);
+
+		  ProductNode *node = at(root); vector<Product> &names = node->m_Names;
+		  names.erase(remove_if(names.begin(), names.end(), [&](const Product &name) { return m_Products[name].m_Count != node->m_Count; }), names.end());
+		  if (!(names.empty())) buckets.emplace_back(node->m_Count, move(names));
+
+		  collect_buckets(node->m_Right, buckets);
 	  }
 
   	   /**
-		* @brief Update auxiliary information for a node.
+		* @brief Build a perfectly balanced tree from buckets sorted in ascending order of the count.
 		*
-		* @param root The node to update.
+		* @param buckets The (count, product names) buckets, whose names are moved into the nodes.
+		* @param lo The first bucket of the subtree.
+		* @param hi The bucket past the last one of the subtree.
+		* @return NodeIndex The root of the subtree.
 		*/
-	  void update_auxiliary_info(ProductNode *root)
+	  NodeIndex build_tree(vector<pair<size_t, vector<Product>>> &buckets, size_t lo, size_t hi)
 	  {
-		  root->m_SumNames = root->m_Names.size(); root->m_SumCounts = (root->m_SumNames * root->m_Count);
-		  if (root->m_Left) { root->m_SumNames += root->m_Left->m_SumNames; root->m_SumCounts += root->m_Left->m_SumCounts; }
-		  if (root->m_Right) { root->m_SumNames += root->m_Right->m_SumNames; root->m_SumCounts += root->m_Right->m_SumCounts; }
+		  if (lo == hi) return 0;
+
+		  size_t mid = lo + (hi - lo) / 2;
+		  NodeIndex subtreeLeft = build_tree(buckets, lo, mid), subtreeRight = build_tree(buckets, mid + 1, hi);
+
+		  if (m_Nodes.size() > numeric_limits<NodeIndex>::max()) throw length_error("");
+		  STATS_COUNT_IF(m_Nodes.size() == m_Nodes.capacity(), m_Allocations);
+		  NodeIndex root = m_Nodes.size(); m_Nodes.emplace_back();
+
+		  ProductNode *node = at(root);
+		  node->m_Count = buckets[mid].first; node->m_Names = move(buckets[mid].second); node->m_Left = subtreeLeft; node->m_Right = subtreeRight;
+		  for (size_t i = 0; i < node->m_Names.size(); ++i) m_Products[node->m_Names[i]].m_Slot = i;
+		  set_height(node); update_auxiliary_info(node);
+
+		  return root;
 	  }
 
   	   /**
-		* @brief Balance the node.
+		* @brief Move a product from the bucket of its old count to the bucket of its new count.
 		*
-		* @param root The node to balance.
-		* @return ProductNode* The new root after balancing.
+		* Only the aggregates on the root paths of both buckets are adjusted, unless a bucket has to be created or emptied,
+		* in which case a single structural pass (insertion or deletion) is made.
+		*
+		* @param name The product name.
+		* @param countOld The number of units sold before the sale.
+		* @param countNew The number of units sold after the sale, greater than countOld.
 		*/
-	  ProductNode *balance_node(ProductNode *root)
+	  void increment_node(const Product &name, size_t countOld, size_t countNew)
 	  {
-		  set_height(root);
+		  size_t countNext = numeric_limits<size_t>::max();
+		  NodeIndex nodeOld = find_node(countOld, &countNext), nodeNew = (countNext == countNew) ? find_node(countNew) : 0;
 
-		  if (get_balance(root) == 2)
-		  {
-			  if (get_balance(root->m_Right) < 0) root->m_Right = rotate_right(root->m_Right);
-			  return rotate_left(root);
-		  }
-		  if (get_balance(root) == -2)
+		  if (at(nodeOld)->m_Names.size() > 1)
 		  {
-			  if (get_balance(root->m_Left) > 0) root->m_Left = rotate_left(root->m_Left);
-			  return rotate_right(root);
+			  pop_name(at(nodeOld), name);
+			  update_path(countOld, -1, -static_cast<ptrdiff_t>(countOld));
+
+			  if (nodeNew) { push_name(at(nodeNew), name); update_path(countNew, 1, countNew); }
+			  else m_Root = insert_node(m_Root, name, countNew);
 		  }
-		  update_auxiliary_info(root);
+		  else if (countNext > countNew) { at(nodeOld)->m_Count = countNew; update_path(countNew, 0, countNew - countOld); }
+		  else if (nodeNew) { m_Root = delete_node(m_Root, name, countOld); push_name(at(nodeNew), name); update_path(countNew, 1, countNew); }
+		  else { m_Root = delete_node(m_Root, name, countOld); m_Root = insert_node(m_Root, name, countNew); }
+	  }
 
-		  return root;
+  	   /**
+		* @brief Append a product to a bucket and remember its slot.
+		*
+		* @param root The bucket node.
+		* @param name The product name.
+		*/
+	  void push_name(ProductNode *root, const Product &name)
+	  {
+		  STATS_COUNT_IF(root->m_Names.size() == root->m_Names.capacity(), m_Allocations);
+		  m_Products[name].m_Slot = root->m_Names.size(); root->m_Names.push_back(name);
 	  }
 
-  	      /**
-		   * @brief Delete a node from the tree.
-		   *
-		   * @param root The root node.
-		   * @param name The product name.
-		   * @param count The number of units sold.
-		   * @return ProductNode* The new root after deletion.
-		   */
-	  ProductNode *delete_node(ProductNode *root, const Product &name, size_t count)
+  	   /**
+		* @brief Remove a product from a bucket by moving the last product of the bucket into its slot.
+		*
+		* @param root The bucket node.
+		* @param name The product name.
+		*/
+	  void pop_name(ProductNode *root, const Product &name)
 	  {
-		  if (!root) return nullptr;
+		  size_t slot = m_Products[name].m_Slot;
+		  if (slot + 1 != root->m_Names.size()) { root->m_Names[slot] = root->m_Names.back(); m_Products[root->m_Names[slot]].m_Slot = slot; }
+		  root->m_Names.pop_back();
+	  }
 
-		  if (count < root->m_Count) root->m_Left = delete_node(root->m_Left, name, count);
-		  else if (count > root->m_Count) root->m_Right = delete_node(root->m_Right, name, count);
-		  else
+  	   /**
+		* @brief Find the bucket node holding the given number of units sold.
+		*
+		* @param count The number of units sold.
+		* @param countNext If not null, receives the smallest bucket count greater than count (left untouched if there is none).
+		* @return NodeIndex The bucket node, or 0 if there is none.
+		*/
+	  NodeIndex find_node(size_t count, size_t *countNext = nullptr) const
+	  {
+		  NodeIndex tmp = m_Root;
+		  while (tmp)
 		  {
-			  bool shouldDelete = false;
-			  auto it = find(root->m_Names.begin(), root->m_Names.end(), name); if (it != root->m_Names.end()) root->m_Names.erase(it);
-			  if (root->m_Names.empty()) shouldDelete = true;
+			  const ProductNode *node = at(tmp);
+			  if (count < node->m_Count) { if (countNext) *countNext = node->m_Count; tmp = node->m_Left; }
+			  else if (count > node->m_Count) tmp = node->m_Right;
+			  else { if (countNext && node->m_Right) *countNext = at(get_minimum(node->m_Right))->m_Count; break; }
+		  }
 
-			  if (shouldDelete)
-			  {
-				  ProductNode *subtreeLeft = root->m_Left, *subtreeRight = root->m_Right;
-				  delete root;
+		  return tmp;
+	  }
 
-				  if (!subtreeRight) return subtreeLeft;
+  	   /**
+		* @brief Adjust the aggregates of all nodes on the root path of an existing bucket, the bucket included.
+		*
+		* @param count The number of units sold of the bucket.
+		* @param names The change of the number of products.
+		* @param counts The change of the number of units sold.
+		*/
+	  void update_path(size_t count, ptrdiff_t names, ptrdiff_t counts)
+	  {
+		  ProductNode *tmp = at(m_Root);
+		  while (tmp)
+		  {
+			  tmp->m_SumNames += names; tmp->m_SumCounts += counts;
+			  if (count < tmp->m_Count) tmp = at(tmp->m_Left);
+			  else if (count > tmp->m_Count) tmp = at(tmp->m_Right);
+			  else break;
+		  }
+	  }
+
+  	   /**
+		* @brief Get the height of a node.
+		*
+		* @param root The node to get the height of.
+		* @return size_t The height of the node.
+		*/
+	  size_t get_height(NodeIndex root) const { return root ? at(root)->m_Height : 0; }
+
+  	 /**
+	  * @brief Get the balance factor of a node.
+	  *
+	  * @param root The node to get the balance factor of.
+	  * @return int The balance factor of the node.
+	  */
+	  int get_balance(NodeIndex root) const { return get_height(at(root)->m_Right) - get_height(at(root)->m_Left); }
+
+  	   /**
+		* @brief Get the node with the minimum value.
+		*
+		* @param root The root node.
+		* @return NodeIndex The node with the minimum value.
+		*/
+	  NodeIndex get_minimum(NodeIndex root) const { return !(at(root)->m_Left) ? root : get_minimum(at(root)->m_Left); }
+
+  	   /**
+		* @brief Set the height of a node.
+		*
+		* @param root The node to set the height of.
+		*/
+	  void set_height(ProductNode *root)
+	  {
+		  size_t heightLeft = get_height(root->m_Left), heightRight = get_height(root->m_Right);
+		  root->m_Height = (heightRight > heightLeft ? heightRight : heightLeft) + 1;
+		  STATS_RAISE(m_Height, root->m_Height);
+	  }
+
+  	   /**
+		* @brief Delete the minimum node.
+		*
+		* @param root The root node.
+		* @return NodeIndex The new root after deletion.
+		*/
+	  NodeIndex delete_minimum(NodeIndex root)
+	  {
+		  if (!(at(root)->m_Left)) return at(root)->m_Right;
+		  at(root)->m_Left = delete_minimum(at(root)->m_Left);
+
+		  return balance_node(root);
+	  }
+
+  	   /**
+		* @brief Rotate the tree to the left.
+		*
+		* @param root The root node.
+		* @return NodeIndex The new root after rotation.
+		*/
+	  NodeIndex rotate_left(NodeIndex root)
+	  {
+		  STATS_COUNT(m_Rotations);
+		  ProductNode *node = at(root); NodeIndex subtreeRight = node->m_Right;
+		  node->m_Right = at(subtreeRight)->m_Left;
+		  at(subtreeRight)->m_Left = root;
+		  set_height(node); set_height(at(subtreeRight));
+		  update_auxiliary_info(node); update_auxiliary_info(at(subtreeRight));
+
+		  return subtreeRight;
+	  }
+
+  	   /**
+		* @brief Rotate the tree to the right.
+		*
+		* @param root The root node.
+		* @return NodeIndex The new root after rotation.
+		*/
+	  NodeIndex rotate_right(NodeIndex root)
+	  {
+		  STATS_COUNT(m_Rotations);
+		  ProductNode *node = at(root); NodeIndex subtreeLeft = node->m_Left;
+		  node->m_Left = at(subtreeLeft)->m_Right;
+		  at(subtreeLeft)->m_Right = root;
+		  set_height(node); set_height(at(subtreeLeft));
+		  update_auxiliary_info(node); update_auxiliary_info(at(subtreeLeft));
+
+		  return subtreeLeft;
+	  }
+
+  	   /**
+		* @brief Update auxiliary information for a node.
+		*
+		* @param root The node to update.
+		*/
+	  void update_auxiliary_info(ProductNode *root)
+	  {
+		  root->m_SumNames = root->m_Names.size(); root->m_SumCounts = (root->m_SumNames * root->m_Count);
+		  if (root->m_Left) { root->m_SumNames += at(root->m_Left)->m_SumNames; root->m_SumCounts += at(root->m_Left)->m_SumCounts; }
+		  if (root->m_Right) { root->m_SumNames += at(root->m_Right)->m_SumNames; root->m_SumCounts += at(root->m_Right)->m_SumCounts; }
+	  }
+
+  	   /**
+		* @brief Balance the node.
+		*
+		* @param root The node to balance.
+		* @return NodeIndex The new root after balancing.
+		*/
+	  NodeIndex balance_node(NodeIndex root)
+	  {
+		  ProductNode *node = at(root);
+		  set_height(node);
+
+		  if (get_balance(root) == 2)
+		  {
+			  if (get_balance(node->m_Right) < 0) node->m_Right = rotate_right(node->m_Right);
+			  return rotate_left(root);
+		  }
+		  if (get_balance(root) == -2)
+		  {
+			  if (get_balance(node->m_Left) > 0) node->m_Left = rotate_left(node->m_Left);
+			  return rotate_right(root);
+		  }
+		  update_auxiliary_info(node);
+
+		  return root;
+	  }
+
+  	      /**
+		   * @brief Delete a node from the tree.
+		   *
+		   * @param root The root node.
+		   * @param name The product name.
+		   * @param count The number of units sold.
+		   * @return NodeIndex The new root after deletion.
+		   */
+	  NodeIndex delete_node(NodeIndex root, const Product &name, size_t count)
+	  {
+		  if (!root) return 0;
+
+		  ProductNode *node = at(root);
+		  if (count < node->m_Count) node->m_Left = delete_node(node->m_Left, name, count);
+		  else if (count > node->m_Count) node->m_Right = delete_node(node->m_Right, name, count);
+		  else
+		  {
+			  bool shouldDelete = false;
+			  pop_name(node, name);
+			  if (node->m_Names.empty()) shouldDelete = true;
+
+			  if (shouldDelete)
+			  {
+				  NodeIndex subtreeLeft = node->m_Left, subtreeRight = node->m_Right;
+				  release_node(root);
+
+				  if (!subtreeRight) return subtreeLeft;
+
+				  NodeIndex minimum = get_minimum(subtreeRight);
+				  at(minimum)->m_Right = delete_minimum(subtreeRight);
+				  at(minimum)->m_Left = subtreeLeft;
+
+				  return balance_node(minimum);
+			  }
+		  }
+
+		  return balance_node(root);
+	  }
+
+  	      /**
+		   * @brief Insert a node into the tree.
+		   *
+		   * @param root The root node.
+		   * @param name The product name.
+		   * @param count The number of units sold.
+		   * @return NodeIndex The new root after insertion.
+		   */
+	  NodeIndex insert_node(NodeIndex root, const Product &name, size_t count)
+	  {
+		  if (!root) return new_node(name, count);
+
+		  if (count < at(root)->m_Count) { NodeIndex subtreeLeft = insert_node(at(root)->m_Left, name, count); at(root)->m_Left = subtreeLeft; }
+		  else if (count > at(root)->m_Count) { NodeIndex subtreeRight = insert_node(at(root)->m_Right, name, count); at(root)->m_Right = subtreeRight; }
+		  else push_name(at(root), name);
+
+		  return balance_node(root);
+	  }
+
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Class to manage the products in an order-statistic B+-tree.
+ *
+ * The leaves hold buckets of products with the same number of units sold in descending order of that number, so ranks
+ * grow from left to right. Every node stores, per child, the largest count of the child subtree together with its number
+ * of products and units sold. On x86-64 a node takes 200 bytes padded to four cache lines: the keys fill the first line,
+ * the unit sums the second, the product sums and children the third and the size and leaf flag the fourth. Routing by
+ * count (route()) thus reads two lines per level, the keys and the size, and descending by rank two, the product sums
+ * with the children and the leaf flag, plus the unit sums for prefix sums.
+ * Emptied buckets stay in their leaves as tombstones (with no products) and are dropped by a bottom-up rebuild once they
+ * outnumber the live buckets, which keeps deletion free of merges and borrows. Products are dense IDs, so their entries
+ * live in a vector indexed by ID, where an entry with no units sold stands for a product not in the tree.
+ */
+template < typename Product >
+class ProductBTree {
+	  using NodeIndex = uint32_t;
+
+public:
+		/**
+		 * @brief Forward iterator over the products in rank order, yielding (product, units sold) pairs.
+		 */
+	  class RankIterator {
+	  public:
+		  pair<const Product&, size_t> operator*() const
+		  {
+			  const BNode &leaf = m_Tree->m_Nodes[m_Path[m_Depth - 1].first]; uint32_t i = m_Path[m_Depth - 1].second;
+			  return {m_Tree->m_Buckets[leaf.m_Children[i]][m_Slot], leaf.m_Keys[i]};
+		  }
+
+		  RankIterator &operator++()
+		  {
+			  if (++m_Rank > m_Tree->get_uniques()) return *this;
+
+			  const BNode *leaf = &m_Tree->m_Nodes[m_Path[m_Depth - 1].first];
+			  if (++m_Slot < leaf->m_SumNames[m_Path[m_Depth - 1].second]) return *this;
+
+			  m_Slot = 0;
+			  do
+			  {
+				  size_t level = m_Depth - 1;
+				  while (++m_Path[level].second == m_Tree->m_Nodes[m_Path[level].first].m_Size) --level;
+				  for (++level; level < m_Depth; ++level) m_Path[level] = {m_Tree->m_Nodes[m_Path[level - 1].first].m_Children[m_Path[level - 1].second], 0};
+				  leaf = &m_Tree->m_Nodes[m_Path[m_Depth - 1].first];
+			  }
+			  while (!(leaf->m_SumNames[m_Path[m_Depth - 1].second]));
+
+			  return *this;
+		  }
+
+		  bool operator==(const RankIterator &other) const { return m_Rank == other.m_Rank; }
+		  bool operator!=(const RankIterator &other) const { return m_Rank != other.m_Rank; }
+
+		  size_t rank() const { return m_Rank; }
+
+	  private:
+		  friend class ProductBTree;
+
+		  const ProductBTree *m_Tree; size_t m_Slot, m_Rank; uint32_t m_Depth; array<pair<NodeIndex, uint32_t>, 32> m_Path;
+	  };
+
+	  ProductBTree() : m_Products(), m_Nodes(1), m_Buckets(), m_FreeBuckets(), m_Root(0), m_Uniques(0), m_Entries(0), m_Tombstones(0) {}
+
+  	  // ---------------------------------------------------------------------------------------------------------------
+
+		/**
+		 * @brief Get the number of unique products.
+		 *
+		 * @return size_t The number of unique products.
+		 */
+	  size_t get_uniques() const { return m_Uniques; }
+
+		/**
+		 * @brief Check whether a product is in the tree.
+		 *
+		 * @param name The product name.
+		 * @return bool True if the product has been sold and not withdrawn.
+		 */
+	  bool contains(const Product &name) const { return static_cast<size_t>(name) < m_Products.size() && m_Products[name].m_Count; }
+
+		/**
+		 * @brief Insert a product into the tree; a sale of no units is ignored.
+		 *
+		 * @param name The product name.
+		 * @param count The number of units sold.
+		 */
+	  void insert_node(const Product &name, size_t count)
+	  {
+		  if (!count) return;
+
+		  ProductEntry &entry = get_entry(name);
+		  if (!(entry.m_Count)) { entry.m_Count = count; ++m_Uniques; push_name(name, count); }
+		  else { size_t countOld = entry.m_Count; entry.m_Count += count; pop_name(name, countOld); push_name(name, entry.m_Count); }
+	  }
+
+		/**
+		 * @brief Insert a batch of sales of distinct products into the tree.
+		 *
+		 * The sales are applied in descending order of the resulting counts, so consecutive updates share most of their root
+		 * paths. A batch touching at least 1 / BATCH_REBUILD of the products instead rebuilds the tree in O(n): the live
+		 * buckets are filtered in order, merged with the sorted batch and packed into fresh leaves bottom-up.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct products and positive amounts.
+		 */
+	  void insert_batch(vector<pair<Product, size_t>> &sales)
+	  {
+		  size_t uniques = m_Uniques;
+		  for (auto &sale : sales) { if (contains(sale.first)) sale.second += m_Products[sale.first].m_Count; else ++uniques; }
+		  update_batch(sales, uniques);
+	  }
+
+		/**
+		 * @brief Withdraw a batch of earlier sales of distinct products from the tree, the same way insert_batch() adds them.
+		 *
+		 * Products left with no units sold are removed from the tree.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct tracked products and positive amounts.
+		 */
+	  void remove_batch(vector<pair<Product, size_t>> &sales)
+	  {
+		  for (auto &sale : sales)
+		  {
+			  if (!(contains(sale.first)) || sale.second > m_Products[sale.first].m_Count) throw out_of_range("");
+			  sale.second = m_Products[sale.first].m_Count - sale.second;
+		  }
+		  update_batch(sales, m_Uniques);
+	  }
+
+		/**
+		 * @brief Replace the contents of the tree by products given in rank order, packing the leaves bottom-up in O(n).
+		 *
+		 * @param ranked The (product name, number of units sold) pairs of distinct products in descending order of the count.
+		 */
+	  void assign_ranked(vector<pair<Product, size_t>> &ranked)
+	  {
+		  m_Products.clear(); m_Buckets.clear(); m_FreeBuckets.clear(); m_Uniques = ranked.size();
+
+		  vector<pair<size_t, uint32_t>> entries;
+		  for (const auto &sale : ranked)
+		  {
+			  if (entries.empty() || entries.back().first != sale.second) entries.emplace_back(sale.second, new_bucket());
+			  vector<Product> &names = m_Buckets[entries.back().second];
+			  get_entry(sale.first) = {sale.second, names.size()}; names.push_back(sale.first);
+		  }
+
+		  build(entries);
+	  }
+
+		/**
+		 * @brief Get the rank of a product.
+		 *
+		 * @param name The product name.
+		 * @return size_t The rank of the product.
+		 */
+	  size_t get_rank(const Product &name) const
+	  {
+		  if (!(contains(name))) throw out_of_range("");
+
+		  const ProductEntry &entry = m_Products[name]; size_t count = entry.m_Count, rank = 0; const BNode *node = &m_Nodes[m_Root];
+		  while (!(node->m_Leaf))
+		  {
+			  size_t i = route(*node, count);
+			  for (size_t j = 0; j < i; ++j) rank += node->m_SumNames[j];
+			  node = &m_Nodes[node->m_Children[i]];
+		  }
+
+		  for (size_t j = 0; node->m_Keys[j] != count; ++j) rank += node->m_SumNames[j];
+
+		  return rank + entry.m_Slot + 1;
+	  }
+
+		/**
+		 * @brief Get the product at the specified rank.
+		 *
+		 * @param rank The rank of the product.
+		 * @return const Product& The product at the specified rank.
+		 */
+	  const Product& get_product(size_t rank) const
+	  {
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
+
+		  size_t before = 0; const BNode *leaf = nullptr; size_t i = locate(rank, before, leaf);
+
+		  return m_Buckets[leaf->m_Children[i]][rank - before - 1];
+	  }
+
+		/**
+		 * @brief Get an iterator to the product at the specified rank.
+		 *
+		 * The iterator keeps the slot taken at every level of the tree, so walking k products costs O(log n + k).
+		 *
+		 * @param rank The rank of the product, or the number of products plus one for the end iterator.
+		 * @return RankIterator The iterator.
+		 */
+	  RankIterator get_iterator(size_t rank) const
+	  {
+		  if (rank > get_uniques() + 1 || rank < 1) throw out_of_range("");
+
+		  RankIterator it; it.m_Tree = this; it.m_Slot = 0; it.m_Rank = rank; it.m_Depth = 0;
+		  if (rank > get_uniques()) return it;
+
+		  size_t before = 0; NodeIndex tmp = m_Root;
+		  while (true)
+		  {
+			  const BNode &node = m_Nodes[tmp]; uint32_t i = 0;
+			  for (; rank > before + node.m_SumNames[i]; ++i) before += node.m_SumNames[i];
+			  it.m_Path[it.m_Depth++] = {tmp, i};
+			  if (node.m_Leaf) break;
+			  tmp = node.m_Children[i];
+		  }
+		  it.m_Slot = rank - before - 1;
+
+		  return it;
+	  }
+
+		/**
+		 * @brief Get the number of copies sold of the product at the specified rank.
+		 *
+		 * @param rank The rank of the product.
+		 * @return size_t The number of copies sold.
+		 */
+	  size_t get_sold(size_t rank) const
+	  {
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
+
+		  size_t before = 0; const BNode *leaf = nullptr; size_t i = locate(rank, before, leaf);
+
+		  return leaf->m_Keys[i];
+	  }
+
+		/**
+		 * @brief Get the total number of copies sold for products in the given rank interval.
+		 *
+		 * @param from The starting rank.
+		 * @param to The ending rank.
+		 * @return size_t The total number of copies sold.
+		 */
+	  size_t get_sold(size_t from, size_t to) const
+	  {
+		  if (to > get_uniques() || from < 1 || from > to) throw out_of_range("");
+
+		  return get_prefix(to) - get_prefix(from - 1);
+	  }
+
+		/**
+		 * @brief Get the first rank where the number of copies sold matches the specified rank.
+		 *
+		 * @param rank The rank to check.
+		 * @return size_t The first rank with the same number of copies sold.
+		 */
+	  size_t first_same_rank(size_t rank) const
+	  {
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
+
+		  size_t before = 0; const BNode *leaf = nullptr; locate(rank, before, leaf);
+
+		  return before + 1;
+	  }
+
+		/**
+		 * @brief Get the last rank where the number of copies sold matches the specified rank.
+		 *
+		 * @param rank The rank to check.
+		 * @return size_t The last rank with the same number of copies sold.
+		 */
+	  size_t last_same_rank(size_t rank) const
+	  {
+		  if (rank > get_uniques() || rank < 1) throw out_of_range("");
+
+		  size_t before = 0; const BNode *leaf = nullptr; size_t i = locate(rank, before, leaf);
+
+		  return before + leaf->m_SumNames[i];
+	  }
+
+		/**
+		 * @brief Get the smallest rank whose top-ranked products sold at least the given number of units, in one descent.
+		 *
+		 * @param units The number of units, between 1 and the total number of units sold.
+		 * @return size_t The smallest such rank.
+		 */
+	  size_t get_cover(size_t units) const
+	  {
+		  if (!units || !m_Root || units > get_sums(m_Root).second) throw out_of_range("");
+
+		  size_t before = 0, rankBefore = 0; NodeIndex tmp = m_Root;
+		  while (true)
+		  {
+			  const BNode &node = m_Nodes[tmp]; size_t i = 0;
+			  for (; units > before + node.m_SumCounts[i]; ++i) { before += node.m_SumCounts[i]; rankBefore += node.m_SumNames[i]; }
+
+			  if (node.m_Leaf) return rankBefore + (units - before + node.m_Keys[i] - 1) / node.m_Keys[i];
+			  tmp = node.m_Children[i];
+		  }
+	  }
+
+		/**
+		 * @brief Count the products that sold at least the given number of units, in one descent.
+		 *
+		 * Inner keys are the largest counts of their subtrees, so every subtree followed by one whose largest count still
+		 * reaches the threshold is counted as a whole.
+		 *
+		 * @param count The number of units sold.
+		 * @return size_t The number of such products.
+		 */
+	  size_t get_at_least(size_t count) const
+	  {
+		  size_t atLeast = 0; NodeIndex tmp = m_Root;
+		  while (tmp)
+		  {
+			  const BNode &node = m_Nodes[tmp]; size_t i = 0;
+			  while (i + 1 < node.m_Size && node.m_Keys[i + 1] >= count) atLeast += node.m_SumNames[i++];
+			  if (node.m_Keys[i] < count) break;
+
+			  if (node.m_Leaf) { atLeast += node.m_SumNames[i]; break; }
+			  tmp = node.m_Children[i];
+		  }
+
+		  return atLeast;
+	  }
+
+private:
+	  static constexpr size_t FANOUT = 8, FILL = 6, BATCH_REBUILD = 4;
+
+	  struct alignas(64) BNode {
+		  size_t m_Keys[FANOUT]; size_t m_SumCounts[FANOUT];
+		  uint32_t m_SumNames[FANOUT]; NodeIndex m_Children[FANOUT];
+		  uint32_t m_Size; bool m_Leaf;
+	  };
+	  static_assert(sizeof(size_t) != 8 || sizeof(BNode) == 4 * 64, "BNode is expected to span four cache lines");
+
+	  struct ProductEntry {
+		  size_t m_Count; size_t m_Slot;
+	  };
+
+	  vector<ProductEntry> m_Products; vector<BNode> m_Nodes; vector<vector<Product>> m_Buckets;
+	  vector<uint32_t> m_FreeBuckets; NodeIndex m_Root; size_t m_Uniques, m_Entries, m_Tombstones;
+
+  	   /**
+		* @brief Get the child of an inner node whose subtree holds the given count, or the leaf slot where it belongs.
+		*
+		* @param node The node.
+		* @param count The number of units sold.
+		* @return size_t The last slot whose key is not smaller than count, or 0 if there is none.
+		*/
+	  static size_t route(const BNode &node, size_t count)
+	  {
+		  size_t i = 0;
+		  while (i + 1 < node.m_Size && node.m_Keys[i + 1] >= count) ++i;
+
+		  return i;
+	  }
+
+  	   /**
+		* @brief Get the entry of a product, growing the entries to cover its ID.
+		*
+		* @param name The product name.
+		* @return ProductEntry& The entry, with no units sold if the product is not in the tree.
+		*/
+	  ProductEntry &get_entry(const Product &name)
+	  {
+		  size_t index = name;
+		  if (index >= m_Products.size()) m_Products.resize(index + 1, {0, 0});
+
+		  return m_Products[index];
+	  }
+
+  	   /**
+		* @brief Descend to the bucket holding the product of the given rank.
+		*
+		* @param rank The rank, valid for the tree.
+		* @param before Receives the number of products ranked before the bucket.
+		* @param leaf Receives the leaf holding the bucket.
+		* @return size_t The slot of the bucket in the leaf.
+		*/
+	  size_t locate(size_t rank, size_t &before, const BNode *&leaf) const
+	  {
+		  const BNode *node = &m_Nodes[m_Root]; size_t i;
+		  while (true)
+		  {
+			  for (i = 0; rank > before + node->m_SumNames[i]; ++i) before += node->m_SumNames[i];
+			  if (node->m_Leaf) break;
+			  node = &m_Nodes[node->m_Children[i]];
+		  }
+		  leaf = node;
+
+		  return i;
+	  }
+
+  	   /**
+		* @brief Get the total number of copies sold by the products of rank 1 to rank.
+		*
+		* @param rank The rank, 0 to the number of products.
+		* @return size_t The total number of copies sold.
+		*/
+	  size_t get_prefix(size_t rank) const
+	  {
+		  if (!rank) return 0;
+
+		  size_t before = 0, sold = 0; const BNode *node = &m_Nodes[m_Root];
+		  while (true)
+		  {
+			  size_t i = 0;
+			  for (; rank > before + node->m_SumNames[i]; ++i) { before += node->m_SumNames[i]; sold += node->m_SumCounts[i]; }
+			  if (node->m_Leaf) return sold + (rank - before) * node->m_Keys[i];
+			  node = &m_Nodes[node->m_Children[i]];
+		  }
+	  }
+
+  	   /**
+		* @brief Find the bucket of the given count.
+		*
+		* @param count The number of units sold.
+		* @return uint32_t The bucket index, or the number of buckets if there is none.
+		*/
+	  uint32_t find_bucket(size_t count) const
+	  {
+		  if (!m_Root) return m_Buckets.size();
+
+		  const BNode *node = &m_Nodes[m_Root];
+		  while (!(node->m_Leaf)) node = &m_Nodes[node->m_Children[route(*node, count)]];
+
+		  size_t i = route(*node, count);
+
+		  return (node->m_Keys[i] == count) ? node->m_Children[i] : m_Buckets.size();
+	  }
+
+  	   /**
+		* @brief Adjust the sums on the root path of an existing bucket, the leaf slot of the bucket included.
+		*
+		* @param count The number of units sold of the bucket.
+		* @param names The change of the number of products.
+		* @param counts The change of the number of units sold.
+		*/
+	  void update_path(size_t count, ptrdiff_t names, ptrdiff_t counts)
+	  {
+		  BNode *node = &m_Nodes[m_Root];
+		  while (true)
+		  {
+			  size_t i = route(*node, count);
+			  node->m_SumNames[i] += names; node->m_SumCounts[i] += counts;
+			  if (node->m_Leaf) break;
+			  node = &m_Nodes[node->m_Children[i]];
+		  }
+	  }
+
+  	   /**
+		* @brief Add a product to the bucket of the given count, creating or reviving the bucket if needed.
+		*
+		* @param name The product name.
+		* @param count The number of units sold.
+		*/
+	  void push_name(const Product &name, size_t count)
+	  {
+		  uint32_t bucket = find_bucket(count);
+		  if (bucket == m_Buckets.size()) bucket = insert_bucket(count);
+		  else if (m_Buckets[bucket].empty()) --m_Tombstones;
+
+		  m_Products[name].m_Slot = m_Buckets[bucket].size(); m_Buckets[bucket].push_back(name);
+		  update_path(count, 1, count);
+	  }
+
+  	   /**
+		* @brief Remove a product from the bucket of the given count by moving the last product of the bucket into its slot.
+		*
+		* @param name The product name.
+		* @param count The number of units sold.
+		*/
+	  void pop_name(const Product &name, size_t count)
+	  {
+		  vector<Product> &names = m_Buckets[find_bucket(count)]; size_t slot = m_Products[name].m_Slot;
+		  if (slot + 1 != names.size()) { names[slot] = names.back(); m_Products[names[slot]].m_Slot = slot; }
+		  names.pop_back();
+		  update_path(count, -1, -static_cast<ptrdiff_t>(count));
+
+		  if (names.empty() && ++m_Tombstones * 2 > m_Entries) rebuild();
+	  }
+
+  	   /**
+		* @brief Append an empty node to the pool.
+		*
+		* @param leaf Whether the node is a leaf.
+		* @return NodeIndex The index of the new node.
+		*/
+	  NodeIndex new_node(bool leaf)
+	  {
+		  if (m_Nodes.size() > numeric_limits<NodeIndex>::max()) throw length_error("");
+		  m_Nodes.emplace_back(); m_Nodes.back().m_Size = 0; m_Nodes.back().m_Leaf = leaf;
+
+		  return m_Nodes.size() - 1;
+	  }
+
+  	   /**
+		* @brief Get the number of products and units sold in the subtree of a node.
+		*
+		* @param root The node.
+		* @return pair<uint32_t, size_t> The number of products and units sold.
+		*/
+	  pair<uint32_t, size_t> get_sums(NodeIndex root) const
+	  {
+		  const BNode &node = m_Nodes[root]; pair<uint32_t, size_t> sums = {0, 0};
+		  for (size_t i = 0; i < node.m_Size; ++i) { sums.first += node.m_SumNames[i]; sums.second += node.m_SumCounts[i]; }
+
+		  return sums;
+	  }
+
+  	   /**
+		* @brief Insert a slot into a node, splitting the node in halves if it is full.
+		*
+		* @param root The node.
+		* @param pos The position of the new slot.
+		* @param key The largest count of the slot.
+		* @param child The child node, or the bucket index in a leaf.
+		* @return NodeIndex The new right sibling if the node was split, otherwise 0.
+		*/
+	  NodeIndex insert_slot(NodeIndex root, size_t pos, size_t key, NodeIndex child)
+	  {
+		  NodeIndex sibling = 0;
+		  if (m_Nodes[root].m_Size == FANOUT)
+		  {
+			  sibling = new_node(m_Nodes[root].m_Leaf);
+			  BNode &node = m_Nodes[root], &next = m_Nodes[sibling]; size_t half = FANOUT / 2;
+			  copy(node.m_Keys + half, node.m_Keys + FANOUT, next.m_Keys); copy(node.m_SumCounts + half, node.m_SumCounts + FANOUT, next.m_SumCounts);
+			  copy(node.m_SumNames + half, node.m_SumNames + FANOUT, next.m_SumNames); copy(node.m_Children + half, node.m_Children + FANOUT, next.m_Children);
+			  node.m_Size = half; next.m_Size = FANOUT - half;
+			  if (pos > half) { pos -= half; root = sibling; }
+		  }
+
+		  BNode &node = m_Nodes[root];
+		  copy_backward(node.m_Keys + pos, node.m_Keys + node.m_Size, node.m_Keys + node.m_Size + 1);
+		  copy_backward(node.m_SumCounts + pos, node.m_SumCounts + node.m_Size, node.m_SumCounts + node.m_Size + 1);
+		  copy_backward(node.m_SumNames + pos, node.m_SumNames + node.m_Size, node.m_SumNames + node.m_Size + 1);
+		  copy_backward(node.m_Children + pos, node.m_Children + node.m_Size, node.m_Children + node.m_Size + 1);
+		  node.m_Keys[pos] = key; node.m_Children[pos] = child; ++node.m_Size;
+		  auto sums = node.m_Leaf ? make_pair(uint32_t(0), size_t(0)) : get_sums(child); node.m_SumNames[pos] = sums.first; node.m_SumCounts[pos] = sums.second;
+
+		  return sibling;
+	  }
+
+  	   /**
+		* @brief Insert an empty bucket into the subtree of a node.
+		*
+		* @param root The node.
+		* @param count The number of units sold of the bucket.
+		* @param bucket The bucket index.
+		* @return NodeIndex The new right sibling if the node was split, otherwise 0.
+		*/
+	  NodeIndex insert_entry(NodeIndex root, size_t count, uint32_t bucket)
+	  {
+		  if (m_Nodes[root].m_Leaf)
+		  {
+			  const BNode &node = m_Nodes[root]; size_t pos = 0;
+			  while (pos < node.m_Size && node.m_Keys[pos] > count) ++pos;
+
+			  return insert_slot(root, pos, count, bucket);
+		  }
+
+		  size_t i = route(m_Nodes[root], count); if (m_Nodes[root].m_Keys[i] < count) m_Nodes[root].m_Keys[i] = count;
+		  NodeIndex sibling = insert_entry(m_Nodes[root].m_Children[i], count, bucket);
+		  if (!sibling) return 0;
+
+		  auto sums = get_sums(m_Nodes[root].m_Children[i]); m_Nodes[root].m_SumNames[i] = sums.first; m_Nodes[root].m_SumCounts[i] = sums.second;
+
+		  return insert_slot(root, i + 1, m_Nodes[sibling].m_Keys[0], sibling);
+	  }
+
+  	   /**
+		* @brief Take an empty bucket from the free list, or append a new one.
+		*
+		* @return uint32_t The bucket index.
+		*/
+	  uint32_t new_bucket()
+	  {
+		  uint32_t bucket;
+		  if (!(m_FreeBuckets.empty())) { bucket = m_FreeBuckets.back(); m_FreeBuckets.pop_back(); }
+		  else { bucket = m_Buckets.size(); m_Buckets.emplace_back(); }
+
+		  return bucket;
+	  }
+
+  	   /**
+		* @brief Create an empty bucket for the given count and insert it into the tree.
+		*
+		* @param count The number of units sold.
+		* @return uint32_t The bucket index.
+		*/
+	  uint32_t insert_bucket(size_t count)
+	  {
+		  uint32_t bucket = new_bucket();
+		  if (!m_Root) m_Root = new_node(true);
+
+		  NodeIndex sibling = insert_entry(m_Root, count, bucket);
+		  if (sibling)
+		  {
+			  NodeIndex root = new_node(false);
+			  insert_slot(root, 0, m_Nodes[m_Root].m_Keys[0], m_Root); insert_slot(root, 1, m_Nodes[sibling].m_Keys[0], sibling);
+			  m_Root = root;
+		  }
+		  ++m_Entries;
+
+		  return bucket;
+	  }
+
+  	   /**
+		* @brief Move a batch of distinct products to their new counts, either one by one or by rebuilding the tree.
+		*
+		* @param sales The (product name, new number of units sold) pairs; a product with no units sold is removed.
+		* @param uniques The number of products in the tree once the batch is applied, counting the removed ones.
+		*/
+	  void update_batch(vector<pair<Product, size_t>> &sales, size_t uniques)
+	  {
+		  sort(sales.begin(), sales.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+		  m_Uniques = uniques;
+
+		  if (sales.size() * BATCH_REBUILD < uniques)
+		  {
+			  for (const auto &sale : sales)
+			  {
+				  ProductEntry &entry = get_entry(sale.first);
+				  if (!(entry.m_Count)) { entry.m_Count = sale.second; push_name(sale.first, sale.second); }
+				  else
+				  {
+					  pop_name(sale.first, entry.m_Count); entry.m_Count = sale.second;
+					  if (sale.second) push_name(sale.first, sale.second); else --m_Uniques;
+				  }
+			  }
+			  return;
+		  }
+
+		  for (const auto &sale : sales) { get_entry(sale.first).m_Count = sale.second; if (!(sale.second)) --m_Uniques; }
+
+		  vector<pair<size_t, uint32_t>> entriesOld, entries; if (m_Root) collect_entries(m_Root, entriesOld); entries.reserve(entriesOld.size() + sales.size());
+		  auto it = entriesOld.begin();
+		  auto append = [&](const pair<size_t, uint32_t> &entry) {
+			  vector<Product> &names = m_Buckets[entry.second];
+			  names.erase(remove_if(names.begin(), names.end(), [&](const Product &name) { return m_Products[name].m_Count != entry.first; }), names.end());
+			  if (names.empty()) m_FreeBuckets.push_back(entry.second); else entries.push_back(entry);
+		  };
+		  for (const auto &sale : sales)
+		  {
+			  if (!(sale.second)) break;
+			  for (; it != entriesOld.end() && it->first >= sale.second; ++it) append(*it);
+			  if (entries.empty() || entries.back().first != sale.second) entries.emplace_back(sale.second, new_bucket());
+			  m_Buckets[entries.back().second].push_back(sale.first);
+		  }
+		  for (; it != entriesOld.end(); ++it) append(*it);
+
+		  for (const auto &entry : entries)
+		  {
+			  const vector<Product> &names = m_Buckets[entry.second];
+			  for (size_t i = 0; i < names.size(); ++i) m_Products[names[i]].m_Slot = i;
+		  }
+		  build(entries);
+	  }
+
+  	   /**
+		* @brief Collect the live buckets of a subtree in rank order and release the emptied ones.
+		*
+		* @param root The node.
+		* @param entries Receives the (count, bucket) pairs.
+		*/
+	  void collect_entries(NodeIndex root, vector<pair<size_t, uint32_t>> &entries)
+	  {
+		  const BNode &node = m_Nodes[root];
+		  for (size_t i = 0; i < node.m_Size; ++i)
+		  {
+			  if (!(node.m_Leaf)) collect_entries(node.m_Children[i], entries);
+			  else if (node.m_SumNames[i]) entries.emplace_back(node.m_Keys[i], node.m_Children[i]);
+			  else m_FreeBuckets.push_back(node.m_Children[i]);
+		  }
+	  }
+
+  	   /**
+		* @brief Rebuild the tree bottom-up from its live buckets, dropping the tombstones.
+		*/
+	  void rebuild()
+	  {
+		  vector<pair<size_t, uint32_t>> entries; entries.reserve(m_Entries - m_Tombstones);
+		  if (m_Root) collect_entries(m_Root, entries);
+
+		  build(entries);
+	  }
+
+  	   /**
+		* @brief Replace the tree by leaves packed bottom-up from buckets in descending order of the count.
+		*
+		* @param entries The (count, bucket) pairs of non-empty buckets.
+		*/
+	  void build(const vector<pair<size_t, uint32_t>> &entries)
+	  {
+		  m_Nodes.resize(1); m_Root = 0; m_Entries = entries.size(); m_Tombstones = 0;
+		  if (entries.empty()) return;
+
+		  vector<NodeIndex> level;
+		  for (size_t i = 0; i < entries.size(); i += FILL)
+		  {
+			  NodeIndex leaf = new_node(true); BNode &node = m_Nodes[leaf];
+			  for (size_t j = i; j < min(i + FILL, entries.size()); ++j)
+			  {
+				  size_t count = entries[j].first, names = m_Buckets[entries[j].second].size();
+				  node.m_Keys[node.m_Size] = count; node.m_Children[node.m_Size] = entries[j].second;
+				  node.m_SumNames[node.m_Size] = names; node.m_SumCounts[node.m_Size] = names * count; ++node.m_Size;
+			  }
+			  level.push_back(leaf);
+		  }
+
+		  while (level.size() > 1)
+		  {
+			  vector<NodeIndex> levelUpper;
+			  for (size_t i = 0; i < level.size(); i += FILL)
+			  {
+				  NodeIndex root = new_node(false);
+				  for (size_t j = i; j < min(i + FILL, level.size()); ++j) insert_slot(root, j - i, m_Nodes[level[j]].m_Keys[0], level[j]);
+				  levelUpper.push_back(root);
+			  }
+			  level.swap(levelUpper);
+		  }
+
+		  m_Root = level.front();
+	  }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Class to manage the products in a persistent AVL tree for point-in-time queries.
+ *
+ * Every product has its own immutable node ordered by (count descending, insertion sequence), so ranks grow from left to
+ * right and a tie group never has to be copied. insert_node() path-copies: it replaces only the O(log n) nodes on the
+ * paths of the removed and the inserted key and shares every other subtree with the previous version. A Snapshot holds
+ * the root of one version; nodes are reference counted and reclaimed once no version uses them any more. Products are
+ * dense IDs, so a node holds the ID itself and the current entries live in a vector indexed by ID, where an entry with
+ * no units sold stands for a product not in the tree.
+ */
+template < typename Product >
+class PersistentProductTree {
+	  struct PNode;
+	  using NodePtr = shared_ptr<const PNode>;
+
+public:
+		/**
+		 * @brief Read-only handle to one version of the tree.
+		 */
+	  class Snapshot {
+	  public:
+			/**
+			 * @brief Get the number of updates applied before the version was taken.
+			 *
+			 * @return size_t The version number.
+			 */
+		  size_t version() const { return m_Version; }
+
+			/**
+			 * @brief Get the number of unique products of the version.
+			 *
+			 * @return size_t The number of unique products.
+			 */
+		  size_t products() const { return get_names(m_Root.get()); }
+
+			/**
+			 * @brief Get the product with the given rank in the version.
+			 *
+			 * @param rank The rank of the product.
+			 * @return const Product& The product with the specified rank.
+			 */
+		  const Product& product(size_t rank) const { return get_node(m_Root.get(), rank)->m_Name; }
+
+			/**
+			 * @brief Get the number of copies sold of the product with the given rank in the version.
+			 *
+			 * @param rank The rank of the product.
+			 * @return size_t The number of copies sold.
+			 */
+		  size_t sold(size_t rank) const { return get_node(m_Root.get(), rank)->m_Count; }
+
+			/**
+			 * @brief Get the total number of copies sold for products in the given rank interval in the version.
+			 *
+			 * @param from The starting rank.
+			 * @param to The ending rank.
+			 * @return size_t The total number of copies sold.
+			 */
+		  size_t sold(size_t from, size_t to) const { return get_sold(m_Root.get(), from, to); }
+
+	  private:
+		  friend class PersistentProductTree;
+
+		  Snapshot(NodePtr root, size_t version) : m_Root(move(root)), m_Version(version) {}
+
+		  NodePtr m_Root; size_t m_Version;
+	  };
+
+		/**
+		 * @brief Forward iterator over the products of the current version in rank order, yielding (product, units sold) pairs.
+		 */
+	  class RankIterator {
+	  public:
+		  pair<const Product&, size_t> operator*() const { return {m_Node->m_Name, m_Node->m_Count}; }
+
+		  RankIterator &operator++()
+		  {
+			  ++m_Rank;
+			  for (const PNode *tmp = m_Node->m_Right.get(); tmp; tmp = tmp->m_Left.get()) m_Path[m_Depth++] = tmp;
+			  m_Node = m_Depth ? m_Path[--m_Depth] : nullptr;
+
+			  return *this;
+		  }
+
+		  bool operator==(const RankIterator &other) const { return m_Rank == other.m_Rank; }
+		  bool operator!=(const RankIterator &other) const { return m_Rank != other.m_Rank; }
+
+		  size_t rank() const { return m_Rank; }
+
+	  private:
+		  friend class PersistentProductTree;
+
+		  const PNode *m_Node; size_t m_Rank; uint32_t m_Depth; array<const PNode*, 64> m_Path;
+	  };
+
+	  PersistentProductTree() : m_Products(), m_Root(), m_Sequence(0), m_Version(0) {}
+
+  	  // ---------------------------------------------------------------------------------------------------------------
+
+		/**
+		 * @brief Get a handle to the current version of the tree.
+		 *
+		 * @return Snapshot The handle, sharing all nodes with the tree.
+		 */
+	  Snapshot snapshot() const { return Snapshot(m_Root, m_Version); }
+
+		/**
+		 * @brief Get the number of unique products.
+		 *
+		 * @return size_t The number of unique products.
+		 */
+	  size_t get_uniques() const { return get_names(m_Root.get()); }
+
+		/**
+		 * @brief Check whether a product is in the current version.
+		 *
+		 * @param name The product name.
+		 * @return bool True if the product has been sold and not withdrawn.
+		 */
+	  bool contains(const Product &name) const { return static_cast<size_t>(name) < m_Products.size() && m_Products[name].m_Count; }
+
+		/**
+		 * @brief Insert a product into the tree by path copying; a sale of no units is ignored.
+		 *
+		 * @param name The product name.
+		 * @param count The number of units sold.
+		 */
+	  void insert_node(const Product &name, size_t count)
+	  {
+		  if (!count) return;
+
+		  ProductEntry &entry = get_entry(name);
+		  if (entry.m_Count) m_Root = delete_node(m_Root, entry.m_Count, entry.m_Sequence);
+
+		  entry.m_Count += count; entry.m_Sequence = m_Sequence++;
+		  PNode key = {name, entry.m_Count, entry.m_Sequence, 0, 0, 0, nullptr, nullptr};
+		  m_Root = insert_node(m_Root, key); ++m_Version;
+	  }
+
+		/**
+		 * @brief Insert a batch of sales of distinct products into the tree, one path copy per sale.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct products and positive amounts.
+		 */
+	  void insert_batch(vector<pair<Product, size_t>> &sales) { for (const auto &sale : sales) insert_node(sale.first, sale.second); }
+
+		/**
+		 * @brief Withdraw a batch of earlier sales of distinct products, one path copy per sale.
+		 *
+		 * Products left with no units sold are removed from the tree.
+		 *
+		 * @param sales The (product name, number of units sold) pairs, with distinct tracked products and positive amounts.
+		 */
+	  void remove_batch(vector<pair<Product, size_t>> &sales)
+	  {
+		  for (const auto &sale : sales) if (!(contains(sale.first)) || sale.second > m_Products[sale.first].m_Count) throw out_of_range("");
+
+		  for (const auto &sale : sales)
+		  {
+			  ProductEntry &entry = m_Products[sale.first];
+			  m_Root = delete_node(m_Root, entry.m_Count, entry.m_Sequence); ++m_Version;
+			  if (!(entry.m_Count -= sale.second)) continue;
+
+			  entry.m_Sequence = m_Sequence++;
+			  PNode key = {sale.first, entry.m_Count, entry.m_Sequence, 0, 0, 0, nullptr, nullptr};
+			  m_Root = insert_node(m_Root, key);
+		  }
+	  }
+
+		/**
+		 * @brief Replace the contents of the tree by products given in rank order, building a new version bottom-up in O(n).
+		 *
+		 * @param ranked The (product name, number of units sold) pairs of distinct products in descending order of the count.
+		 */
+	  void assign_ranked(vector<pair<Product, size_t>> &ranked)
+	  {
+		  m_Products.clear();
+
+		  vector<PNode> keys; keys.reserve(ranked.size());
+		  for (const auto &sale : ranked)
+		  {
+			  ProductEntry &entry = get_entry(sale.first); entry = {sale.second, m_Sequence++};
+			  keys.push_back({sale.first, entry.m_Count, entry.m_Sequence, 0, 0, 0, nullptr, nullptr});
+		  }
+
+		  m_Root = build_tree(keys, 0, keys.size()); ++m_Version;
+	  }
+
+		/**
+		 * @brief Get the rank of a product.
+		 *
+		 * @param name The product name.
+		 * @return size_t The rank of the product.
+		 */
+	  size_t get_rank(const Product &name) const
+	  {
+		  if (!(contains(name))) throw out_of_range("");
+
+		  size_t count = m_Products[name].m_Count, rank = 0; uint64_t sequence = m_Products[name].m_Sequence; const PNode *tmp = m_Root.get();
+		  while (tmp)
+		  {
+			  if (count > tmp->m_Count || (count == tmp->m_Count && sequence < tmp->m_Sequence)) tmp = tmp->m_Left.get();
+			  else
+			  {
+				  rank += get_names(tmp->m_Left.get()) + 1;
+				  if (count == tmp->m_Count && sequence == tmp->m_Sequence) break;
+				  tmp = tmp->m_Right.get();
+			  }
+		  }
+
+		  return rank;
+	  }
+
+		/**
+		 * @brief Get the product at the specified rank.
+		 *
+		 * @param rank The rank of the product.
+		 * @return const Product& The product at the specified rank.
+		 */
+	  const Product& get_product(size_t rank) const { return get_node(m_Root.get(), rank)->m_Name; }
+
+		/**
+		 * @brief Get an iterator to the product at the specified rank, walking k products in O(log n + k).
+		 *
+		 * @param rank The rank of the product, or the number of products plus one for the end iterator.
+		 * @return RankIterator The iterator.
+		 */
+	  RankIterator get_iterator(size_t rank) const
+	  {
+		  if (rank > get_uniques() + 1 || rank < 1) throw out_of_range("");
+
+		  RankIterator it; it.m_Node = nullptr; it.m_Rank = rank; it.m_Depth = 0;
+		  const PNode *tmp = (rank <= get_uniques()) ? m_Root.get() : nullptr;
+		  while (tmp)
+		  {
+			  size_t namesLeft = get_names(tmp->m_Left.get());
+			  if (rank <= namesLeft) { it.m_Path[it.m_Depth++] = tmp; tmp = tmp->m_Left.get(); }
+			  else if (rank == namesLeft + 1) { it.m_Node = tmp; break; }
+			  else { rank -= namesLeft + 1; tmp = tmp->m_Right.get(); }
+		  }
+
+		  return it;
+	  }
+
+		/**
+		 * @brief Get the number of copies sold of the product at the specified rank.
+		 *
+		 * @param rank The rank of the product.
+		 * @return size_t The number of copies sold.
+		 */
+	  size_t get_sold(size_t rank) const { return get_node(m_Root.get(), rank)->m_Count; }
+
+		/**
+		 * @brief Get the total number of copies sold for products in the given rank interval.
+		 *
+		 * @param from The starting rank.
+		 * @param to The ending rank.
+		 * @return size_t The total number of copies sold.
+		 */
+	  size_t get_sold(size_t from, size_t to) const { return get_sold(m_Root.get(), from, to); }
+
+		/**
+		 * @brief Get the first rank where the number of copies sold matches the specified rank.
+		 *
+		 * @param rank The rank to check.
+		 * @return size_t The first rank with the same number of copies sold.
+		 */
+	  size_t first_same_rank(size_t rank) const { return get_above(get_node(m_Root.get(), rank)->m_Count, false) + 1; }
+
+		/**
+		 * @brief Get the last rank where the number of copies sold matches the specified rank.
+		 *
+		 * @param rank The rank to check.
+		 * @return size_t The last rank with the same number of copies sold.
+		 */
+	  size_t last_same_rank(size_t rank) const { return get_above(get_node(m_Root.get(), rank)->m_Count, true); }
+
+		/**
+		 * @brief Get the smallest rank whose top-ranked products sold at least the given number of units, in one descent.
+		 *
+		 * @param units The number of units, between 1 and the total number of units sold.
+		 * @return size_t The smallest such rank.
+		 */
+	  size_t get_cover(size_t units) const
+	  {
+		  if (!units || !m_Root || units > m_Root->m_SumCounts) throw out_of_range("");
+
+		  size_t before = 0, rankBefore = 0; const PNode *tmp = m_Root.get();
+		  while (true)
+		  {
+			  const PNode *left = tmp->m_Left.get(); size_t countsLeft = left ? left->m_SumCounts : 0;
+
+			  if (units <= before + countsLeft) tmp = left;
+			  else if (units <= before + countsLeft + tmp->m_Count) return rankBefore + get_names(left) + 1;
+			  else { before += countsLeft + tmp->m_Count; rankBefore += get_names(left) + 1; tmp = tmp->m_Right.get(); }
+		  }
+	  }
+
+		/**
+		 * @brief Count the products that sold at least the given number of units, in one descent.
+		 *
+		 * @param count The number of units sold.
+		 * @return size_t The number of such products.
+		 */
+	  size_t get_at_least(size_t count) const { return get_above(count, true); }
+
+private:
+	  struct PNode {
+		  Product m_Name; size_t m_Count; uint64_t m_Sequence; size_t m_SumNames, m_SumCounts;
+		  uint32_t m_Height; NodePtr m_Left, m_Right;
+	  };
+
+	  struct ProductEntry {
+		  size_t m_Count; uint64_t m_Sequence;
+	  };
+
+	  vector<ProductEntry> m_Products; NodePtr m_Root; uint64_t m_Sequence; size_t m_Version;
+
+  	   /**
+		* @brief Get the entry of a product, growing the entries to cover its ID.
+		*
+		* @param name The product name.
+		* @return ProductEntry& The entry, with no units sold if the product is not in the tree.
+		*/
+	  ProductEntry &get_entry(const Product &name)
+	  {
+		  size_t index = name;
+		  if (index >= m_Products.size()) m_Products.resize(index + 1, {0, 0});
+
+		  return m_Products[index];
+	  }
+
+  	   /**
+		* @brief Get the number of products in a subtree.
+		*
+		* @param root The root node.
+		* @return size_t The number of products.
+		*/
+	  static size_t get_names(const PNode *root) { return root ? root->m_SumNames : 0; }
+
+  	   /**
+		* @brief Get the node of the given rank in a version.
+		*
+		* @param root The root of the version.
+		* @param rank The rank of the product.
+		* @return const PNode* The node of the product.
+		*/
+	  static const PNode *get_node(const PNode *root, size_t rank)
+	  {
+		  if (rank > get_names(root) || rank < 1) throw out_of_range("");
+
+		  while (true)
+		  {
+			  size_t namesLeft = get_names(root->m_Left.get());
+			  if (rank <= namesLeft) root = root->m_Left.get();
+			  else if (rank == namesLeft + 1) return root;
+			  else { rank -= namesLeft + 1; root = root->m_Right.get(); }
+		  }
+	  }
+
+  	   /**
+		* @brief Get the total number of copies sold by the products of rank 1 to rank in a version.
+		*
+		* @param root The root of the version.
+		* @param rank The rank, 0 to the number of products.
+		* @return size_t The total number of copies sold.
+		*/
+	  static size_t get_prefix(const PNode *root, size_t rank)
+	  {
+		  size_t sold = 0;
+		  while (rank)
+		  {
+			  size_t namesLeft = get_names(root->m_Left.get());
+			  if (rank <= namesLeft) root = root->m_Left.get();
+			  else
+			  {
+				  sold += (root->m_Left ? root->m_Left->m_SumCounts : 0) + root->m_Count;
+				  rank -= namesLeft + 1; root = root->m_Right.get();
+			  }
+		  }
+
+		  return sold;
+	  }
+
+  	   /**
+		* @brief Get the total number of copies sold for products in the given rank interval of a version.
+		*
+		* @param root The root of the version.
+		* @param from The starting rank.
+		* @param to The ending rank.
+		* @return size_t The total number of copies sold.
+		*/
+	  static size_t get_sold(const PNode *root, size_t from, size_t to)
+	  {
+		  if (to > get_names(root) || from < 1 || from > to) throw out_of_range("");
+
+		  return get_prefix(root, to) - get_prefix(root, from - 1);
+	  }
+
+  	   /**
+		* @brief Count the products of the current version that sold more than (or at least) the given number of copies.
+		*
+		* @param count The number of units sold.
+		* @param inclusive Whether products with exactly count units are counted as well.
+		* @return size_t The number of such products.
+		*/
+	  size_t get_above(size_t count, bool inclusive) const
+	  {
+		  size_t above = 0; const PNode *tmp = m_Root.get();
+		  while (tmp)
+		  {
+			  if (tmp->m_Count > count || (inclusive && tmp->m_Count == count)) { above += get_names(tmp->m_Left.get()) + 1; tmp = tmp->m_Right.get(); }
+			  else tmp = tmp->m_Left.get();
+		  }
+
+		  return above;
+	  }
+
+  	   /**
+		* @brief Get the height of a subtree.
+		*
+		* @param root The root node.
+		* @return uint32_t The height of the subtree.
+		*/
+	  static uint32_t get_height(const NodePtr &root) { return root ? root->m_Height : 0; }
+
+  	   /**
+		* @brief Create a node with the key of another node and the given children.
+		*
+		* @param left The left subtree.
+		* @param key The node whose product, count and sequence are taken.
+		* @param right The right subtree.
+		* @return NodePtr The new node.
+		*/
+	  static NodePtr make_node(const NodePtr &left, const PNode &key, const NodePtr &right)
+	  {
+		  size_t sumNames = 1 + get_names(left.get()) + get_names(right.get());
+		  size_t sumCounts = key.m_Count + (left ? left->m_SumCounts : 0) + (right ? right->m_SumCounts : 0);
+
+		  return make_shared<const PNode>(PNode {key.m_Name, key.m_Count, key.m_Sequence, sumNames, sumCounts, max(get_height(left), get_height(right)) + 1, left, right});
+	  }
+
+  	   /**
+		* @brief Build a perfectly balanced tree from nodes sorted in rank order.
+		*
+		* @param keys The nodes whose products, counts and sequences are taken.
+		* @param lo The first node of the subtree.
+		* @param hi The node past the last one of the subtree.
+		* @return NodePtr The root of the subtree.
+		*/
+	  static NodePtr build_tree(const vector<PNode> &keys, size_t lo, size_t hi)
+	  {
+		  if (lo == hi) return nullptr;
+
+		  size_t mid = lo + (hi - lo) / 2;
+		  return make_node(build_tree(keys, lo, mid), keys[mid], build_tree(keys, mid + 1, hi));
+	  }
+
+  	   /**
+		* @brief Create a balanced node from two subtrees whose heights differ by at most two.
+		*
+		* @param left The left subtree.
+		* @param key The node whose product, count and sequence are taken.
+		* @param right The right subtree.
+		* @return NodePtr The new root after balancing.
+		*/
+	  static NodePtr balance_node(const NodePtr &left, const PNode &key, const NodePtr &right)
+	  {
+		  if (get_height(left) > get_height(right) + 1)
+		  {
+			  if (get_height(left->m_Left) >= get_height(left->m_Right)) return make_node(left->m_Left, *left, make_node(left->m_Right, key, right));
+			  return make_node(make_node(left->m_Left, *left, left->m_Right->m_Left), *(left->m_Right), make_node(left->m_Right->m_Right, key, right));
+		  }
+		  if (get_height(right) > get_height(left) + 1)
+		  {
+			  if (get_height(right->m_Right) >= get_height(right->m_Left)) return make_node(make_node(left, key, right->m_Left), *right, right->m_Right);
+			  return make_node(make_node(left, key, right->m_Left->m_Left), *(right->m_Left), make_node(right->m_Left->m_Right, *right, right->m_Right));
+		  }
+
+		  return make_node(left, key, right);
+	  }
+
+  	   /**
+		* @brief Insert a key into a subtree by copying its path.
+		*
+		* @param root The root node.
+		* @param key The key of the new node.
+		* @return NodePtr The root of the new version of the subtree.
+		*/
+	  static NodePtr insert_node(const NodePtr &root, const PNode &key)
+	  {
+		  if (!root) return make_node(nullptr, key, nullptr);
+
+		  if (key.m_Count > root->m_Count || (key.m_Count == root->m_Count && key.m_Sequence < root->m_Sequence))
+			  return balance_node(insert_node(root->m_Left, key), *root, root->m_Right);
+
+		  return balance_node(root->m_Left, *root, insert_node(root->m_Right, key));
+	  }
+
+  	   /**
+		* @brief Delete the minimum node of a subtree by copying its path.
+		*
+		* @param root The root node.
+		* @return NodePtr The root of the new version of the subtree.
+		*/
+	  static NodePtr delete_minimum(const NodePtr &root)
+	  {
+		  if (!(root->m_Left)) return root->m_Right;
+
+		  return balance_node(delete_minimum(root->m_Left), *root, root->m_Right);
+	  }
+
+  	   /**
+		* @brief Delete a key from a subtree by copying its path.
+		*
+		* @param root The root node.
+		* @param count The number of units sold of the key.
+		* @param sequence The sequence of the key.
+		* @return NodePtr The root of the new version of the subtree.
+		*/
+	  static NodePtr delete_node(const NodePtr &root, size_t count, uint64_t sequence)
+	  {
+		  if (count > root->m_Count || (count == root->m_Count && sequence < root->m_Sequence))
+			  return balance_node(delete_node(root->m_Left, count, sequence), *root, root->m_Right);
+		  if (count != root->m_Count || sequence != root->m_Sequence)
+			  return balance_node(root->m_Left, *root, delete_node(root->m_Right, count, sequence));
+
+		  if (!(root->m_Left)) return root->m_Right;
+		  if (!(root->m_Right)) return root->m_Left;
+
+		  const PNode *minimum = root->m_Right.get();
+		  while (minimum->m_Left) minimum = minimum->m_Left.get();
+
+		  return balance_node(root->m_Left, *minimum, delete_minimum(root->m_Right));
+	  }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Encoding of products in the binary snapshot files of Bestsellers: trivially copyable products are stored as their
+ * bytes, which a loaded table can use in place if they are aligned within the file.
+ *
+ * @tparam Product The type of the product being encoded.
+ */
+template < typename Product >
+struct ProductCodec {
+  static_assert(is_trivially_copyable<Product>::value, "ProductCodec has to be specialized for this product type");
+
+  static constexpr bool MAPPABLE = alignof(Product) <= alignof(uint64_t); // Products follow 64-bit counts in a file
+
+	/**
+	 * @brief Append a product to a file.
+	 *
+	 * @param out The file.
+	 * @param name The product name.
+	 */
+  static void write(ostream &out, const Product &name) { out.write(reinterpret_cast<const char*>(&name), sizeof(Product)); }
+
+	/**
+	 * @brief Decode a product from a mapped file and move past it.
+	 *
+	 * @param pos The position of the product, moved past it.
+	 * @param end The end of the file.
+	 * @return optional<Product> The product, or nothing if the file is truncated.
+	 */
+  static optional<Product> read(const char *&pos, const char *end)
+  {
+    if (static_cast<size_t>(end - pos) < sizeof(Product)) return nullopt;
+
+    alignas(Product) char bytes[sizeof(Product)]; memcpy(bytes, pos, sizeof(Product)); pos += sizeof(Product);
+    return *reinterpret_cast<const Product*>(bytes);
+  }
+};
+
+/**
+ * @brief Encoding of string products: their length followed by their characters.
+ */
+template <>
+struct ProductCodec<string> {
+  static constexpr bool MAPPABLE = false;
+
+  static void write(ostream &out, const string &name)
+  {
+    uint32_t length = name.size(); out.write(reinterpret_cast<const char*>(&length), sizeof(length)); out.write(name.data(), length);
+  }
+
+  static optional<string> read(const char *&pos, const char *end)
+  {
+    uint32_t length;
+    if (static_cast<size_t>(end - pos) < sizeof(length)) return nullopt;
+    memcpy(&length, pos, sizeof(length)); pos += sizeof(length);
+    if (static_cast<size_t>(end - pos) < length) return nullopt;
+
+    string name(pos, length); pos += length;
+    return name;
+  }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Table interning products into dense IDs, so that every product is stored once and the trees only handle IDs.
+ *
+ * The products live in a deque, whose elements never move while it grows, and the index maps a product to its ID by
+ * reference. The IDs of released products are recycled for new ones; while a lease on the table is held (by snapshots
+ * that may still resolve them), released IDs are put aside instead, so their slots are not overwritten.
+ *
+ * A table loaded from a file adopts its products in ID order without hashing them, and builds the index on the first
+ * lookup, so a restart costs no more than reading the file. Its products may even stay in the mapped file, which the
+ * table then keeps mapped; their IDs are not recycled, as their slots cannot be overwritten.
+ *
+ * @tparam Product The type of the product being interned.
+ */
+template < typename Product >
+class ProductTable {
+public:
+	  using ProductId = uint32_t;
+
+#ifdef BESTSELLERS_STATS
+		/**
+		 * @brief Instrumentation counters, collected when BESTSELLERS_STATS is defined: the rehashes of the index.
+		 */
+	  struct Stats {
+		  StatsCounter m_Rehashes;
+	  };
+#endif
+
+	  ProductTable()
+		  : m_Mapped(nullptr), m_MappedCount(0), m_Mapping(), m_Names(), m_Ids(), m_Indexed(true), m_IndexMutex(), m_Free(), m_Held(),
+			m_Lease(make_shared<const char>()) {}
+
+	  ProductTable(const ProductTable &other)
+		  : m_Mapped(other.m_Mapped), m_MappedCount(other.m_MappedCount), m_Mapping(other.m_Mapping), m_Names(other.m_Names), m_Ids(),
+			m_Indexed(other.m_Indexed.load()), m_IndexMutex(), m_Free(other.m_Free), m_Held(other.m_Held), m_Lease(make_shared<const char>())
+	  {
+		  if (!m_Indexed) return;
+		  m_Ids.reserve(other.m_Ids.size());
+		  for (const auto &id : other.m_Ids) m_Ids.emplace(cref(get_name(id.second)), id.second);
+	  }
+
+	  ProductTable(ProductTable &&other) : ProductTable() { swap(other); }
+
+	  ProductTable &operator=(ProductTable other) { swap(other); return *this; }
+
+		/**
+		 * @brief Get the ID of a product, assigning it one if it has none yet.
+		 *
+		 * @param name The product name.
+		 * @return ProductId The ID of the product.
+		 */
+	  ProductId intern(const Product &name)
+	  {
+		  build_index();
+		  auto it = m_Ids.find(cref(name));
+		  if (it != m_Ids.end()) return it->second;
+
+		  if (!(m_Held.empty()) && m_Lease.use_count() == 1) { m_Free.insert(m_Free.end(), m_Held.begin(), m_Held.end()); m_Held.clear(); }
+
+		  ProductId id;
+		  if (!(m_Free.empty())) { id = m_Free.back(); m_Free.pop_back(); m_Names[id - m_MappedCount] = name; }
+		  else
+		  {
+			  if (size() > numeric_limits<ProductId>::max()) throw length_error("");
+			  id = size(); m_Names.push_back(name);
+		  }
+		  STATS_REHASH(m_Ids, m_Ids.emplace(cref(get_name(id)), id));
+
+		  return id;
+	  }
+
+		/**
+		 * @brief Reserve room in the index for the given number of products.
+		 *
+		 * @param products The number of products.
+		 */
+	  void reserve(size_t products) { build_index(); STATS_REHASH(m_Ids, m_Ids.reserve(products)); }
+
+		/**
+		 * @brief Replace the contents of the table by products in ID order, without indexing them yet.
+		 *
+		 * The products have to be distinct; duplicates are not detected and the index resolves them to the first one.
+		 *
+		 * @param names The products, the one at position i gets ID i.
+		 */
+	  void adopt(deque<Product> names) { *this = ProductTable(); m_Names = move(names); m_Indexed = false; }
+
+		/**
+		 * @brief Replace the contents of the table by products in ID order that stay in a mapped file, without indexing them
+		 * yet.
+		 *
+		 * The products have to be distinct; duplicates are not detected and the index resolves them to the first one.
+		 *
+		 * @param names The products, the one at position i gets ID i.
+		 * @param count The number of products.
+		 * @param mapping The owner of the mapping, kept by the table and its copies.
+		 */
+	  void adopt(const Product *names, ProductId count, shared_ptr<const void> mapping)
+	  {
+		  *this = ProductTable(); m_Mapped = names; m_MappedCount = count; m_Mapping = move(mapping); m_Indexed = !count;
+	  }
+
+		/**
+		 * @brief Get the ID of an interned product.
+		 *
+		 * @param name The product name.
+		 * @return ProductId The ID of the product.
+		 */
+	  ProductId get_id(const Product &name) const { build_index(); return m_Ids.at(cref(name)); }
+
+		/**
+		 * @brief Look up the ID of a product without interning it.
+		 *
+		 * @param name The product name.
+		 * @return optional<ProductId> The ID of the product, or nothing if it is not interned.
+		 */
+	  optional<ProductId> find(const Product &name) const
+	  {
+		  build_index();
+		  auto it = m_Ids.find(cref(name));
+		  if (it == m_Ids.end()) return nullopt;
+		  return it->second;
+	  }
+
+		/**
+		 * @brief Get the product with the given ID.
+		 *
+		 * @param id The ID of the product.
+		 * @return const Product& The product, stored in the table or its mapped file.
+		 */
+	  const Product& get_name(ProductId id) const { return (id < m_MappedCount) ? m_Mapped[id] : m_Names[id - m_MappedCount]; }
+
+		/**
+		 * @brief Forget a product and make its ID available to new products, which overwrite its slot; the IDs of products
+		 * in a mapped file are not reused.
+		 *
+		 * @param id The ID of the product.
+		 */
+	  void release(ProductId id)
+	  {
+		  build_index();
+		  m_Ids.erase(cref(get_name(id)));
+		  if (id >= m_MappedCount) (m_Lease.use_count() > 1 ? m_Held : m_Free).push_back(id);
+	  }
+
+		/**
+		 * @brief Take a lease on the table, delaying the recycling of released IDs until it is dropped.
+		 *
+		 * @return shared_ptr<const void> The lease.
+		 */
+	  shared_ptr<const void> lease() const { return m_Lease; }
+
+#ifdef BESTSELLERS_STATS
+		/**
+		 * @brief Get the counters collected so far.
+		 *
+		 * @return Stats The counters.
+		 */
+	  Stats get_stats() const { return m_Stats; }
+#endif
+
+private:
+	  using ProductIndex = unordered_map<reference_wrapper<const Product>, ProductId, hash<Product>, equal_to<Product>>;
+
+	  const Product *m_Mapped; ProductId m_MappedCount; shared_ptr<const void> m_Mapping; // IDs below m_MappedCount live in the mapping
+	  deque<Product> m_Names; // The other IDs, from m_MappedCount on
+	  mutable ProductIndex m_Ids; mutable atomic<bool> m_Indexed; mutable mutex m_IndexMutex; // Built by the first lookup
+	  vector<ProductId> m_Free, m_Held; shared_ptr<const char> m_Lease;
+#ifdef BESTSELLERS_STATS
+	  Stats m_Stats;
+#endif
+
+		/**
+		 * @brief Get the number of IDs handed out, released ones included.
+		 *
+		 * @return size_t The number of IDs.
+		 */
+	  size_t size() const { return m_MappedCount + m_Names.size(); }
+
+		/**
+		 * @brief Index all products if the table was adopted and has not been looked up yet; concurrent lookups wait for
+		 * the first one to finish.
+		 */
+	  void build_index() const
+	  {
+		  if (m_Indexed.load(memory_order_acquire)) return;
+
+		  lock_guard<mutex> lock(m_IndexMutex);
+		  if (m_Indexed.load(memory_order_relaxed)) return;
+		  m_Ids.reserve(size());
+		  for (ProductId id = 0; id < size(); ++id) m_Ids.emplace(cref(get_name(id)), id);
+		  m_Indexed.store(true, memory_order_release);
+	  }
+
+		/**
+		 * @brief Exchange the contents of two tables, neither of which may be in use by another thread.
+		 *
+		 * @param other The other table.
+		 */
+	  void swap(ProductTable &other)
+	  {
+		  std::swap(m_Mapped, other.m_Mapped); std::swap(m_MappedCount, other.m_MappedCount); m_Mapping.swap(other.m_Mapping);
+		  m_Names.swap(other.m_Names); m_Ids.swap(other.m_Ids); m_Indexed.store(other.m_Indexed.exchange(m_Indexed.load()));
+		  m_Free.swap(other.m_Free); m_Held.swap(other.m_Held); m_Lease.swap(other.m_Lease);
+#ifdef BESTSELLERS_STATS
+		  std::swap(m_Stats, other.m_Stats);
+#endif
+	  }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Sort a range, splitting it recursively between threads and merging the sorted halves.
+ *
+ * @tparam Iterator Random access iterator.
+ * @tparam Compare Strict weak ordering of the elements.
+ * @param first The first element of the range.
+ * @param last The element past the last one of the range.
+ * @param comp The ordering.
+ * @param threads The number of threads to use, the calling one included.
+ */
+template < typename Iterator, typename Compare >
+void parallel_sort(Iterator first, Iterator last, Compare comp, size_t threads = thread::hardware_concurrency())
+{
+  static constexpr ptrdiff_t SEQUENTIAL_SIZE = 1 << 15;
+  if (threads < 2 || last - first < SEQUENTIAL_SIZE) { sort(first, last, comp); return; }
+
+  Iterator middle = first + (last - first) / 2;
+  thread worker([=]() { parallel_sort(first, middle, comp, threads / 2); });
+  parallel_sort(middle, last, comp, threads - threads / 2);
+  worker.join();
+
+  inplace_merge(first, middle, last, comp);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Template class to manage best-selling products.
+ *
+ * The products are interned into a ProductTable, so the ranking tree only stores and compares their dense IDs.
+ *
+ * @tparam Product The type of the product being tracked.
+ * @tparam Tree The ranking structure backing the products (ProductTree, ProductBTree or PersistentProductTree).
+ */
+template < typename Product, template < typename > class Tree = ProductTree >
+struct Bestsellers {
+  using ProductId = typename ProductTable<Product>::ProductId;
+  using Shop = Tree<ProductId>;
+
+  /**
+   * @brief Forward iterator over the products in rank order, yielding (product, copies sold) pairs.
+   */
+  struct iterator {
+    typename Shop::RankIterator m_It; const ProductTable<Product> *m_Table;
+
+    pair<const Product&, size_t> operator*() const { auto entry = *m_It; return {m_Table->get_name(entry.first), entry.second}; }
+    iterator &operator++() { ++m_It; return *this; }
+    bool operator==(const iterator &other) const { return m_It == other.m_It; }
+    bool operator!=(const iterator &other) const { return m_It != other.m_It; }
+    size_t rank() const { return m_It.rank(); }
+  };
+
+  /**
+   * @brief Pair of iterators over consecutive ranks, usable in a range-based for loop.
+   */
+  struct RankRange {
+    iterator m_Begin, m_End;
+
+    iterator begin() const { return m_Begin; }
+    iterator end() const { return m_End; }
+  };
+
+  /**
+   * @brief Read-only view of one version of a persistent tree. It shares the table version its IDs refer to, so it stays
+   * valid after assign(), load() or the destruction of the Bestsellers, and leases it, so later sales cannot recycle them.
+   */
+  struct Snapshot {
+    typename Shop::Snapshot m_Shop; shared_ptr<const ProductTable<Product>> m_Table; shared_ptr<const void> m_Lease;
+
+    size_t version() const { return m_Shop.version(); }
+    size_t products() const { return m_Shop.products(); }
+    const Product& product(size_t rank) const { return m_Table->get_name(m_Shop.product(rank)); }
+    size_t sold(size_t rank) const { return m_Shop.sold(rank); }
+    size_t sold(size_t from, size_t to) const { return m_Shop.sold(from, to); }
+  };
+
+  /**
+   * @brief Construct a new Bestsellers object.
+   */
+  Bestsellers() : m_Table(make_shared<ProductTable<Product>>()), m_Shop() {}
+
+  /**
+   * @brief Construct a copy of a Bestsellers object, with a table of its own.
+   *
+   * @param other The Bestsellers to copy.
+   */
+  Bestsellers(const Bestsellers &other) : m_Table(make_shared<ProductTable<Product>>(*other.m_Table)), m_Shop(other.m_Shop) {}
+
+  Bestsellers(Bestsellers &&other) = default;
+
+  Bestsellers &operator=(const Bestsellers &other) { if (this != &other) *this = Bestsellers(other); return *this; }
+
+  Bestsellers &operator=(Bestsellers &&other) = default;
+
+  /**
+   * @brief Construct a new Bestsellers object from aggregated sales, see assign().
+   *
+   * @tparam Iterator Iterator over (product, amount) pairs.
+   * @param first The first sale.
+   * @param last The sale past the last one.
+   */
+  template < typename Iterator >
+  Bestsellers(Iterator first, Iterator last) : Bestsellers() { assign(first, last); }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Get the total number of tracked products.
+	 *
+	 * @return size_t The number of unique products.
+	 */
+  size_t products() const { return m_Shop.get_uniques(); }
+
+	/**
+	 * @brief Register the sale of a product; a sale of no copies is ignored, as in sell_batch().
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 */
+  void sell(const Product& p, size_t amount) { if (amount) m_Shop.insert_node(m_Table->intern(p), amount); }
+
+	/**
+	 * @brief Register a batch of sales, aggregating repeated products before the tree is updated; sales of no copies are
+	 * ignored.
+	 *
+	 * @tparam Iterator Iterator over (product, amount) pairs.
+	 * @param first The first sale of the batch.
+	 * @param last The sale past the last one of the batch.
+	 */
+  template < typename Iterator >
+  void sell_batch(Iterator first, Iterator last)
+  {
+    unordered_map<ProductId, size_t> amounts;
+    for (; first != last; ++first) if (first->second) amounts[m_Table->intern(first->first)] += first->second;
+
+    vector<pair<ProductId, size_t>> sales(amounts.begin(), amounts.end());
+    if (!(sales.empty())) m_Shop.insert_batch(sales);
+  }
+
+	/**
+	 * @brief Replace the rankings by the given sales in O(n) plus one sort.
+	 *
+	 * The products are interned into a fresh table sized for the input, their amounts are summed in an array indexed by
+	 * ID, the (ID, amount) pairs are sorted once (in parallel when there are many) and the tree is built bottom-up from
+	 * them, grouping ties into buckets and filling in the aggregates in the same pass. Snapshots taken before keep the
+	 * previous rankings and products.
+	 *
+	 * @tparam Iterator Iterator over (product, amount) pairs; repeated products are summed up.
+	 * @param first The first sale.
+	 * @param last The sale past the last one.
+	 */
+  template < typename Iterator >
+  void assign(Iterator first, Iterator last)
+  {
+    ProductTable<Product> table; vector<size_t> amounts;
+    if constexpr (is_base_of<forward_iterator_tag, typename iterator_traits<Iterator>::iterator_category>::value)
+    {
+      size_t sales = distance(first, last); table.reserve(sales); amounts.reserve(sales);
+    }
+
+    for (; first != last; ++first)
+    {
+      if (!(first->second)) continue;
+      ProductId id = table.intern(first->first);
+      if (id == amounts.size()) amounts.push_back(0);
+      amounts[id] += first->second;
+    }
+
+    vector<pair<ProductId, size_t>> ranked; ranked.reserve(amounts.size());
+    for (ProductId id = 0; id < amounts.size(); ++id) ranked.emplace_back(id, amounts[id]);
+    parallel_sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+
+    Shop shop; shop.assign_ranked(ranked);
+    m_Table = make_shared<ProductTable<Product>>(move(table)); m_Shop = move(shop);
+  }
+
+	/**
+	 * @brief Withdraw a batch of earlier sales; products left with no copies sold are no longer tracked.
+	 *
+	 * @tparam Iterator Iterator over (product, amount) pairs.
+	 * @param first The first sale of the batch.
+	 * @param last The sale past the last one of the batch.
+	 */
+  template < typename Iterator >
+  void unsell_batch(Iterator first, Iterator last)
+  {
+    unordered_map<ProductId, size_t> amounts;
+    for (; first != last; ++first) if (first->second) amounts[m_Table->get_id(first->first)] += first->second;
+
+    unsell_ids(amounts);
+  }
+
+	/**
+	 * @brief Get the rank of a product based on its sales.
+	 *
+	 * @param p The product whose rank is to be retrieved.
+	 * @return size_t The rank of the product.
+	 */
+  size_t rank(const Product& p) const { return m_Shop.get_rank(m_Table->get_id(p)); }
+
+	/**
+	 * @brief Get the product with the given rank.
+	 *
+	 * @param rank The rank of the product.
+	 * @return const Product& The product with the specified rank.
+	 */
+  const Product& product(size_t rank) const { return m_Table->get_name(m_Shop.get_product(rank)); }
+
+	/**
+	 * @brief Get the number of copies sold of the product with the given rank.
+	 *
+	 * @param rank The rank of the product.
+	 * @return size_t The number of copies sold.
+	 */
+  size_t sold(size_t rank) const { return m_Shop.get_sold(rank); }
+
+	/**
+	 * @brief Get the total number of copies sold for products in the given rank interval.
+	 *
+	 * @param from The starting rank.
+	 * @param to The ending rank.
+	 * @return size_t The total number of copies sold.
+	 */
+  size_t sold(size_t from, size_t to) const { return (from == to) ? m_Shop.get_sold(from) : m_Shop.get_sold(from, to); }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Get the first rank where the number of copies sold matches the specified rank.
+	 *
+	 * @param r The rank to check.
+	 * @return size_t The first rank with the same number of copies sold.
+	 */
+  size_t first_same(size_t r) const { return m_Shop.first_same_rank(r); }
+
+	/**
+	 * @brief Get the last rank where the number of copies sold matches the specified rank.
+	 *
+	 * @param r The rank to check.
+	 * @return size_t The last rank with the same number of copies sold.
+	 */
+  size_t last_same(size_t r) const { return m_Shop.last_same_rank(r); }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Get the smallest rank r such that the top r products account for at least the given share of all copies sold.
+	 *
+	 * @param share The share of copies sold, e.g. 0.8 for the Pareto rank.
+	 * @return size_t The smallest such rank.
+	 */
+  size_t cover(double share) const
+  {
+    if (!(share > 0 && share <= 1) || !products()) throw out_of_range("");
+
+    size_t total = sold(1, products()), units = ceil(share * total);
+    return m_Shop.get_cover(min(max<size_t>(units, 1), total));
+  }
+
+	/**
+	 * @brief Get the number of products that sold at least the given number of copies.
+	 *
+	 * @param amount The number of copies sold.
+	 * @return size_t The number of such products.
+	 */
+  size_t at_least(size_t amount) const { return m_Shop.get_at_least(amount); }
+
+	/**
+	 * @brief Get the number of copies sold at the given percentile of the products, i.e. the smallest number of copies
+	 * sold that at least that share of the products does not exceed.
+	 *
+	 * @param p The percentile, between 0 (the lowest ranked product) and 1 (the best-selling one).
+	 * @return size_t The number of copies sold.
+	 */
+  size_t quantile(double p) const
+  {
+    if (!(p >= 0 && p <= 1) || !products()) throw out_of_range("");
+
+    size_t below = max<size_t>(ceil(p * products()), 1);
+    return m_Shop.get_sold(products() - below + 1);
+  }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Get an iterator to the product with the given rank, yielding (product, copies sold) pairs in rank order.
+	 *
+	 * @param rank The rank of the first product.
+	 * @return iterator The iterator, valid until the next sale.
+	 */
+  iterator begin(size_t rank = 1) const { return {m_Shop.get_iterator(rank), m_Table.get()}; }
+
+	/**
+	 * @brief Get the iterator past the lowest ranked product.
+	 *
+	 * @return iterator The end iterator.
+	 */
+  iterator end() const { return {m_Shop.get_iterator(products() + 1), m_Table.get()}; }
+
+	/**
+	 * @brief Get the range of the k best-selling products (all of them if there are fewer).
+	 *
+	 * @param k The number of products.
+	 * @return RankRange The range of ranks 1 to k.
+	 */
+  RankRange top(size_t k) const { return {begin(), {m_Shop.get_iterator(min(k, products()) + 1), m_Table.get()}}; }
+
+	/**
+	 * @brief Get a read-only handle to the current rankings that is not affected by later sales (persistent trees only).
+	 *
+	 * @return Snapshot The snapshot of the tree.
+	 */
+  Snapshot snapshot() const { return {m_Shop.snapshot(), m_Table, m_Table->lease()}; }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Write the rankings to a binary file.
+	 *
+	 * The file holds a 16 byte header (magic and number of products), the copies sold of all products in rank order as
+	 * 64-bit integers and the products in the same order, encoded by ProductCodec. A product's position is its ID, so
+	 * the file is the interned table and the (count, ID) array at once. It is written to path + ".tmp" first and renamed
+	 * over the target once complete, so a failed save leaves the previous file intact.
+	 *
+	 * @param path The path of the file.
+	 * @return bool True if the file was written.
+	 */
+  bool save(const string &path) const
+  {
+    string pathTmp = path + ".tmp";
+    ofstream out(pathTmp, ios::binary | ios::trunc);
+    if (!out) return false;
+
+    uint64_t uniques = products(); out.write(FILE_MAGIC, 8); out.write(reinterpret_cast<const char*>(&uniques), sizeof(uniques));
+    for (auto [p, sold] : *this) { uint64_t count = sold; out.write(reinterpret_cast<const char*>(&count), sizeof(count)); }
+    for (auto [p, sold] : *this) ProductCodec<Product>::write(out, p);
+
+    out.flush(); out.close();
+    if (!out || rename(pathTmp.c_str(), path.c_str())) { remove(pathTmp.c_str()); return false; }
+
+    return true;
+  }
+
+	/**
+	 * @brief Replace the rankings by the ones of a file written by save().
+	 *
+	 * The file is mapped into memory and decoded in one sequential pass; the tree is then built bottom-up in O(n)
+	 * without any rebalancing, and no product is hashed until the first lookup by product. Products that ProductCodec
+	 * marks as mappable are not even copied: the table keeps the file mapped and reads them from it, so the file must not
+	 * be modified in place while they are in use (save() replaces it by a new file instead). Snapshots taken before keep
+	 * the previous rankings and products.
+	 *
+	 * @param path The path of the file.
+	 * @return bool True if the file was loaded, false if it could not be read or is malformed (the rankings are kept).
+	 */
+  bool load(const string &path)
+  {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) || info.st_size < 16) { close(fd); return false; }
+
+    size_t size = info.st_size; void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0); close(fd);
+    if (data == MAP_FAILED) return false;
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    shared_ptr<const void> mapping(data, [size](const void *mapped) { munmap(const_cast<void*>(mapped), size); });
+
+    return load_mapped(static_cast<const char*>(data), size, mapping);
+  }
+
+#ifdef BESTSELLERS_STATS
+	/**
+	 * @brief Get the instrumentation counters of the ranking tree (ProductTree only).
+	 *
+	 * @return auto The counters.
+	 */
+  auto get_stats() const { return m_Shop.get_stats(); }
+
+	/**
+	 * @brief Get the instrumentation counters of the product table.
+	 *
+	 * @return ProductTable<Product>::Stats The counters.
+	 */
+  typename ProductTable<Product>::Stats get_table_stats() const { return m_Table->get_stats(); }
+#endif
+
+protected:
+	/**
+	 * @brief Look up the ID of a tracked product, for front ends that keep per-product state by ID.
+	 *
+	 * @param p The product.
+	 * @return optional<ProductId> The ID of the product, or nothing if it is not tracked.
+	 */
+  optional<ProductId> find_id(const Product& p) const { return m_Table->find(p); }
+
+	/**
+	 * @brief Get the ID of the product with the given rank.
+	 *
+	 * @param rank The rank of the product.
+	 * @return ProductId The ID of the product.
+	 */
+  ProductId get_product_id(size_t rank) const { return m_Shop.get_product(rank); }
+
+	/**
+	 * @brief Register the sale of a product and get its ID.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold, at least 1.
+	 * @return ProductId The ID of the product.
+	 */
+  ProductId sell_id(const Product& p, size_t amount) { ProductId id = m_Table->intern(p); m_Shop.insert_node(id, amount); return id; }
+
+	/**
+	 * @brief Withdraw earlier sales given by product ID; products left with no copies sold are no longer tracked and
+	 * their IDs may be reused.
+	 *
+	 * @param amounts The amount withdrawn per ID, each at least 1.
+	 */
+  void unsell_ids(const unordered_map<ProductId, size_t> &amounts)
+  {
+    vector<pair<ProductId, size_t>> sales(amounts.begin(), amounts.end());
+    if (sales.empty()) return;
+
+    m_Shop.remove_batch(sales);
+    for (const auto &amount : amounts) if (!(m_Shop.contains(amount.first))) m_Table->release(amount.first);
+  }
+
+private:
+  static constexpr char FILE_MAGIC[9] = "BESTSLR1";
+
+  shared_ptr<ProductTable<Product>> m_Table; // Replaced, not modified, by assign() and load(), so snapshots keep their version
+  Shop m_Shop;
+
+	/**
+	 * @brief Decode a mapped file written by save() and replace the rankings by its contents.
+	 *
+	 * The products are adopted in ID order without hashing them, or left in the mapping if ProductCodec allows it.
+	 *
+	 * @param data The contents of the file.
+	 * @param size The size of the file, at least 16 bytes.
+	 * @param mapping The owner of the mapping, kept by the table if it reads the products from it.
+	 * @return bool True if the file was well-formed.
+	 */
+  bool load_mapped(const char *data, size_t size, const shared_ptr<const void> &mapping)
+  {
+    uint64_t uniques;
+    if (memcmp(data, FILE_MAGIC, 8)) return false;
+    memcpy(&uniques, data + 8, sizeof(uniques));
+    if (uniques > (size - 16) / sizeof(uint64_t) || uniques > numeric_limits<ProductId>::max()) return false;
+
+    const char *counts = data + 16, *pos = counts + uniques * sizeof(uint64_t), *end = data + size;
+    vector<pair<ProductId, size_t>> ranked; ranked.reserve(uniques);
+    for (uint64_t i = 0, countPrev = numeric_limits<uint64_t>::max(); i < uniques; ++i)
+    {
+      uint64_t count; memcpy(&count, counts + i * sizeof(uint64_t), sizeof(count));
+      if (!count || count > countPrev) return false;
+
+      ranked.emplace_back(i, count); countPrev = count;
+    }
+
+    ProductTable<Product> table;
+    if constexpr (ProductCodec<Product>::MAPPABLE)
+    {
+      if (static_cast<size_t>(end - pos) != uniques * sizeof(Product)) return false;
+      table.adopt(reinterpret_cast<const Product*>(pos), uniques, mapping);
+    }
+    else
+    {
+      deque<Product> names;
+      for (uint64_t i = 0; i < uniques; ++i)
+      {
+        optional<Product> name = ProductCodec<Product>::read(pos, end);
+        if (!name) return false;
+        names.push_back(move(*name));
+      }
+      if (pos != end) return false;
+      table.adopt(move(names));
+    }
+
+    Shop shop; shop.assign_ranked(ranked);
+    m_Table = make_shared<ProductTable<Product>>(move(table)); m_Shop = move(shop);
+
+    return true;
+  }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Bestsellers restricted to a sliding time window, e.g. the sales of the last hour.
+ *
+ * The window is split into a ring of equally long time buckets, each holding the per-product totals of the sales that
+ * fell into it, keyed by the product IDs of the base, so the products themselves are only stored in its table. Whenever time moves past a bucket, its totals are withdrawn from the tree with one unsell_batch() call
+ * and the bucket is reused, so the queries only reflect the sales of the active buckets and the memory stays bounded by
+ * the number of buckets times the number of products sold within the window.
+ *
+ * The queries do not read the clock: they reflect the window ending at the latest time passed to sell() or expire(), so
+ * after a period without sales callers have to call expire(now) before querying. Bestsellers is a protected base, so
+ * only its queries are reachable and sales cannot bypass the buckets.
+ *
+ * @tparam Product The type of the product being tracked.
+ * @tparam Tree The ranking structure backing the products.
+ */
+template < typename Product, template < typename > class Tree = ProductTree >
+struct WindowedBestsellers : protected Bestsellers<Product, Tree> {
+  using Clock = chrono::steady_clock;
+  using typename Bestsellers<Product, Tree>::iterator;
+  using typename Bestsellers<Product, Tree>::RankRange;
+  using typename Bestsellers<Product, Tree>::Snapshot;
+
+  /**
+   * @brief Construct a new WindowedBestsellers object.
+   *
+   * @param window The length of the window.
+   * @param buckets The number of time buckets the window is split into, i.e. its granularity.
+   */
+  explicit WindowedBestsellers(Clock::duration window, size_t buckets = 60)
+    : Bestsellers<Product, Tree>(), m_Width(max<Clock::duration>(window / static_cast<Clock::rep>(max<size_t>(buckets, 1)), Clock::duration(1))),
+      m_Buckets(max<size_t>(buckets, 1)), m_Slot(numeric_limits<int64_t>::min()) {}
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Register the sale of a product at the given time, expiring the buckets the time has moved past.
+	 *
+	 * Sales older than the window are ignored.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 * @param when The time of the sale.
+	 */
+  void sell(const Product& p, size_t amount, Clock::time_point when)
+  {
+    expire(when);
+
+    int64_t slot = get_slot(when);
+    if (!amount || slot + static_cast<int64_t>(m_Buckets.size()) <= m_Slot) return;
+
+    m_Buckets[get_index(slot)][this->sell_id(p, amount)] += amount;
+  }
+
+	/**
+	 * @brief Register the sale of a product now.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 */
+  void sell(const Product& p, size_t amount) { sell(p, amount, Clock::now()); }
+
+	/**
+	 * @brief Withdraw the sales of all buckets that have left the window ending at the given time; call it before querying
+	 * to move the window to the present.
+	 *
+	 * @param now The end of the window; earlier times than the last one seen are ignored.
+	 */
+  void expire(Clock::time_point now)
+  {
+    int64_t slot = get_slot(now);
+    if (m_Slot == numeric_limits<int64_t>::min()) { m_Slot = slot; return; }
+
+    unordered_map<ProductId, size_t> sales;
+    for (int64_t tmp = m_Slot + 1; tmp <= slot && tmp <= m_Slot + static_cast<int64_t>(m_Buckets.size()); ++tmp)
+    {
+      unordered_map<ProductId, size_t> &bucket = m_Buckets[get_index(tmp)];
+      for (const auto &sale : bucket) sales[sale.first] += sale.second;
+      bucket.clear();
+    }
+    m_Slot = max(m_Slot, slot);
+
+    this->unsell_ids(sales);
+  }
+
+  using Bestsellers<Product, Tree>::products;
+  using Bestsellers<Product, Tree>::rank;
+  using Bestsellers<Product, Tree>::product;
+  using Bestsellers<Product, Tree>::sold;
+  using Bestsellers<Product, Tree>::first_same;
+  using Bestsellers<Product, Tree>::last_same;
+  using Bestsellers<Product, Tree>::cover;
+  using Bestsellers<Product, Tree>::at_least;
+  using Bestsellers<Product, Tree>::quantile;
+  using Bestsellers<Product, Tree>::begin;
+  using Bestsellers<Product, Tree>::end;
+  using Bestsellers<Product, Tree>::top;
+  using Bestsellers<Product, Tree>::snapshot;
+  using Bestsellers<Product, Tree>::save;
+
+private:
+  using ProductId = typename Bestsellers<Product, Tree>::ProductId;
+
+  Clock::duration m_Width; vector<unordered_map<ProductId, size_t>> m_Buckets; int64_t m_Slot;
+
+	/**
+	 * @brief Get the number of the time bucket a time falls into, counted from the epoch of the clock.
+	 *
+	 * @param when The time.
+	 * @return int64_t The number of the bucket.
+	 */
+  int64_t get_slot(Clock::time_point when) const { return when.time_since_epoch() / m_Width; }
+
+	/**
+	 * @brief Get the position of a time bucket in the ring.
+	 *
+	 * @param slot The number of the bucket.
+	 * @return size_t The position of the bucket.
+	 */
+  size_t get_index(int64_t slot) const { int64_t size = m_Buckets.size(); return ((slot % size) + size) % size; }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Approximate Bestsellers tracking at most a fixed number of products (Space-Saving heavy-hitter summary).
+ *
+ * While there is room every product is counted exactly. Once the summary is full, a sale of an untracked product evicts
+ * the lowest ranked one and takes over its count as an overestimate, remembering it as the error of the newcomer. The
+ * memory thus stays bounded by the capacity, the counts are never underestimated, the true count of the product at rank
+ * r lies in [sold(r) - error(r), sold(r)] and every product sold more than max_error() times is tracked. Bestsellers is
+ * a protected base, so only its queries are reachable and sales cannot bypass the eviction.
+ *
+ * @tparam Product The type of the product being tracked.
+ * @tparam Tree The ranking structure backing the tracked products.
+ */
+template < typename Product, template < typename > class Tree = ProductTree >
+struct ApproximateBestsellers : protected Bestsellers<Product, Tree> {
+  using typename Bestsellers<Product, Tree>::iterator;
+  using typename Bestsellers<Product, Tree>::RankRange;
+  using typename Bestsellers<Product, Tree>::Snapshot;
+
+  /**
+   * @brief Construct a new ApproximateBestsellers object.
+   *
+   * @param capacity The largest number of tracked products.
+   */
+  explicit ApproximateBestsellers(size_t capacity) : Bestsellers<Product, Tree>(), m_Capacity(max<size_t>(capacity, 1)), m_Errors() {}
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Register the sale of a product, evicting the lowest ranked product if an untracked one does not fit in.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 */
+  void sell(const Product& p, size_t amount)
+  {
+    if (!amount) return;
+    if (this->find_id(p)) { this->sell_id(p, amount); return; }
+
+    size_t floor = 0;
+    if (this->products() == m_Capacity)
+    {
+      size_t last = this->products(); ProductId evicted = this->get_product_id(last); floor = this->sold(last);
+      m_Errors.erase(evicted); this->unsell_ids({{evicted, floor}});
+    }
+
+    m_Errors[this->sell_id(p, amount + floor)] = floor;
+  }
+
+	/**
+	 * @brief Get the overestimate of the number of copies sold of the product with the given rank.
+	 *
+	 * @param rank The rank of the product.
+	 * @return size_t The largest difference between sold(rank) and the true number of copies sold.
+	 */
+  size_t error(size_t rank) const { return m_Errors.at(this->get_product_id(rank)); }
+
+	/**
+	 * @brief Get the bound on the number of copies sold of any untracked product.
+	 *
+	 * @return size_t The number of copies sold of the lowest ranked product once the summary is full, 0 before.
+	 */
+  size_t max_error() const { return (this->products() < m_Capacity) ? 0 : this->sold(this->products()); }
+
+	/**
+	 * @brief Get the largest number of tracked products.
+	 *
+	 * @return size_t The capacity.
+	 */
+  size_t capacity() const { return m_Capacity; }
+
+  using Bestsellers<Product, Tree>::products;
+  using Bestsellers<Product, Tree>::rank;
+  using Bestsellers<Product, Tree>::product;
+  using Bestsellers<Product, Tree>::sold;
+  using Bestsellers<Product, Tree>::first_same;
+  using Bestsellers<Product, Tree>::last_same;
+  using Bestsellers<Product, Tree>::cover;
+  using Bestsellers<Product, Tree>::at_least;
+  using Bestsellers<Product, Tree>::quantile;
+  using Bestsellers<Product, Tree>::begin;
+  using Bestsellers<Product, Tree>::end;
+  using Bestsellers<Product, Tree>::top;
+  using Bestsellers<Product, Tree>::snapshot;
+  using Bestsellers<Product, Tree>::save;
+
+private:
+  using ProductId = typename Bestsellers<Product, Tree>::ProductId;
+
+  size_t m_Capacity; unordered_map<ProductId, size_t> m_Errors; // Product ID -> overestimate
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Many leaderboards (e.g. per category or region) keyed by a board ID and sharing one product table.
+ *
+ * Every product is interned once for all boards, so each board only holds its ranking tree over product IDs; a sale is
+ * interned once and then applied to the trees of all boards it belongs to. A board is created by its first sale, and a
+ * product is only interned once a sale records it on some board.
+ *
+ * @tparam Product The type of the product being tracked.
+ * @tparam Board The type of the board ID.
+ * @tparam Tree The ranking structure backing the products of each board.
+ */
+template < typename Product, typename Board = size_t, template < typename > class Tree = ProductTree >
+struct MultiBestsellers {
+  using ProductId = typename ProductTable<Product>::ProductId;
+  using iterator = typename Bestsellers<Product, Tree>::iterator;
+  using RankRange = typename Bestsellers<Product, Tree>::RankRange;
+
+  /**
+   * @brief Construct a new MultiBestsellers object without any boards.
+   */
+  MultiBestsellers() : m_Table(), m_Boards() {}
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Get the number of boards.
+	 *
+	 * @return size_t The number of boards with at least one sale.
+	 */
+  size_t boards() const { return m_Boards.size(); }
+
+	/**
+	 * @brief Register the sale of a product on the given boards.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 * @param boards The boards the sale counts towards; a board listed more than once counts once.
+	 */
+  void sell(const Product& p, size_t amount, initializer_list<Board> boards) { sell(p, amount, boards.begin(), boards.end()); }
+
+	/**
+	 * @brief Register the sale of a product on the given boards; a sale of no copies or on no boards is ignored.
+	 *
+	 * @tparam Iterator Iterator over board IDs.
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 * @param first The first of the boards the sale counts towards; a board listed more than once counts once.
+	 * @param last The board past the last one.
+	 */
+  template < typename Iterator >
+  void sell(const Product& p, size_t amount, Iterator first, Iterator last)
+  {
+    if (!amount) return;
+
+    vector<Shop*> shops; for (; first != last; ++first) shops.push_back(&m_Boards[*first]);
+    if (shops.empty()) return;
+    sort(shops.begin(), shops.end()); shops.erase(unique(shops.begin(), shops.end()), shops.end());
+
+    ProductId id = m_Table.intern(p);
+    for (Shop *shop : shops) shop->insert_node(id, amount);
+  }
+
+	/**
+	 * @brief Get the total number of tracked products of a board.
+	 *
+	 * @param board The board.
+	 * @return size_t The number of unique products.
+	 */
+  size_t products(const Board& board) const { return get_board(board).get_uniques(); }
+
+	/**
+	 * @brief Get the rank of a product on a board.
+	 *
+	 * @param board The board.
+	 * @param p The product whose rank is to be retrieved.
+	 * @return size_t The rank of the product.
+	 */
+  size_t rank(const Board& board, const Product& p) const { return get_board(board).get_rank(m_Table.get_id(p)); }
 
-				  ProductNode *minimum = get_minimum(subtreeRight);
-				  minimum->m_Right = delete_minimum(subtreeRight);
-				  minimum->m_Left = subtreeLeft;
+	/**
+	 * @brief Get the product with the given rank on a board.
+	 *
+	 * @param board The board.
+	 * @param rank The rank of the product.
+	 * @return const Product& The product with the specified rank.
+	 */
+  const Product& product(const Board& board, size_t rank) const { return m_Table.get_name(get_board(board).get_product(rank)); }
 
-				  return balance_node(minimum);
-			  }
-		  }
+	/**
+	 * @brief Get the number of copies sold of the product with the given rank on a board.
+	 *
+	 * @param board The board.
+	 * @param rank The rank of the product.
+	 * @return size_t The number of copies sold.
+	 */
+  size_t sold(const Board& board, size_t rank) const { return get_board(board).get_sold(rank); }
 
-		  return balance_node(root);
-	  }
+	/**
+	 * @brief Get the total number of copies sold for products in the given rank interval on a board.
+	 *
+	 * @param board The board.
+	 * @param from The starting rank.
+	 * @param to The ending rank.
+	 * @return size_t The total number of copies sold.
+	 */
+  size_t sold(const Board& board, size_t from, size_t to) const
+  {
+    const Shop &shop = get_board(board);
+    return (from == to) ? shop.get_sold(from) : shop.get_sold(from, to);
+  }
 
-  	      /**
-		   * @brief Insert a node into the tree.
-		   *
-		   * @param root The root node.
-		   * @param name The product name.
-		   * @param count The number of units sold.
-		   * @return ProductNode* The new root after insertion.
-		   */
-	  ProductNode *insert_node(ProductNode *root, const Product &name, size_t count)
-	  {
-		  if (!root) return new ProductNode(name, count);
+	/**
+	 * @brief Get the first rank on a board where the number of copies sold matches the specified rank.
+	 *
+	 * @param board The board.
+	 * @param r The rank to check.
+	 * @return size_t The first rank with the same number of copies sold.
+	 */
+  size_t first_same(const Board& board, size_t r) const { return get_board(board).first_same_rank(r); }
+
+	/**
+	 * @brief Get the last rank on a board where the number of copies sold matches the specified rank.
+	 *
+	 * @param board The board.
+	 * @param r The rank to check.
+	 * @return size_t The last rank with the same number of copies sold.
+	 */
+  size_t last_same(const Board& board, size_t r) const { return get_board(board).last_same_rank(r); }
+
+	/**
+	 * @brief Get the range of the k best-selling products of a board (all of them if there are fewer).
+	 *
+	 * @param board The board.
+	 * @param k The number of products.
+	 * @return RankRange The range of ranks 1 to k.
+	 */
+  RankRange top(const Board& board, size_t k) const
+  {
+    const Shop &shop = get_board(board);
+    return {{shop.get_iterator(1), &m_Table}, {shop.get_iterator(min(k, shop.get_uniques()) + 1), &m_Table}};
+  }
 
-		  if (count < root->m_Count) root->m_Left = insert_node(root->m_Left, name, count);
-		  else if (count > root->m_Count) root->m_Right = insert_node(root->m_Right, name, count);
-		  else root->m_Names.push_back(name);
+private:
+  using Shop = Tree<ProductId>;
 
-		  return balance_node(root);
-	  }
+  ProductTable<Product> m_Table; unordered_map<Board, Shop> m_Boards;
+
+	/**
+	 * @brief Get the ranking tree of a board.
+	 *
+	 * @param board The board.
+	 * @return const Shop& The tree.
+	 */
+  const Shop& get_board(const Board& board) const { return m_Boards.at(board); }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+#if __cpp_lib_atomic_shared_ptr
+template < typename T >
+using AtomicSharedPtr = atomic<shared_ptr<T>>;
+#else
+/**
+ * @brief Stand-in for atomic<shared_ptr<T>> before C++20, built on the atomic access functions for shared_ptr.
+ *
+ * @tparam T The type pointed to.
+ */
+template < typename T >
+class AtomicSharedPtr {
+public:
+  explicit AtomicSharedPtr(shared_ptr<T> p) : m_Pointer(move(p)) {}
+
+  shared_ptr<T> load() const { return atomic_load(&m_Pointer); }
+  shared_ptr<T> exchange(shared_ptr<T> p) { return atomic_exchange(&m_Pointer, move(p)); }
+
+private:
+  shared_ptr<T> m_Pointer;
+};
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
 
+/**
+ * @brief Thread-safe front end of Bestsellers with per-thread ingest and lock-free queries on published snapshots.
+ *
+ * Every writer thread appends its sales to a delta buffer of its own, registered with the object on its first sale, so
+ * writers never contend with each other, only with the merger draining their buffer. A merger thread wakes up every
+ * staleness period, folds all buffers into a Bestsellers through sell_batch() and publishes it with an atomic exchange.
+ * Readers fetch the published one with an atomic load and query it without any locks; it lags behind the sales by at
+ * most the staleness plus one merge. The buffers of threads that exited stay registered until the object is destroyed.
+ *
+ * Two Bestsellers are double-buffered: once the last reader drops a retired one, it is handed back and the next merge
+ * replays the batch it missed before applying the new one, so a merge costs two sell_batch() calls instead of a copy.
+ * Only if a reader still holds it by then is the published one copied.
+ *
+ * @tparam Product The type of the product being tracked.
+ * @tparam Tree The ranking structure backing the products.
+ */
+template < typename Product, template < typename > class Tree = ProductTree >
+struct ConcurrentBestsellers {
+  using Snapshot = shared_ptr<const Bestsellers<Product, Tree>>;
+
+  /**
+   * @brief Construct a new ConcurrentBestsellers object and start its merger thread.
+   *
+   * @param staleness The longest time between two merges.
+   */
+  explicit ConcurrentBestsellers(chrono::milliseconds staleness = chrono::milliseconds(100))
+    : m_Staleness(staleness), m_Id(get_id()), m_Spare(make_shared<Spare>(make_unique<Buffer>())), m_Batch(), m_Merges(0),
+      m_Snapshot(publish(make_unique<Buffer>(), 0)), m_Stop(false), m_Merger(&ConcurrentBestsellers::run_merger, this) {}
+
+  ConcurrentBestsellers(const ConcurrentBestsellers&) = delete;
+  ConcurrentBestsellers& operator=(const ConcurrentBestsellers&) = delete;
+
+  /**
+   * @brief Stop the merger thread and merge the sales still buffered, so snapshots outliving the object see all of them.
+   */
+  ~ConcurrentBestsellers() { { lock_guard<mutex> lock(m_StopMutex); m_Stop = true; } m_Wake.notify_one(); m_Merger.join(); flush(); }
+
+  // -------------------------------------------------------------------------------------------------------------------
+
+	/**
+	 * @brief Register the sale of a product in the delta buffer of the calling thread; it becomes visible to readers with
+	 * the next merge.
+	 *
+	 * @param p The product being sold.
+	 * @param amount The amount sold.
+	 */
+  void sell(const Product& p, size_t amount)
+  {
+    DeltaBuffer &buffer = get_buffer();
+    lock_guard<mutex> lock(buffer.m_Mutex); buffer.m_Sales.emplace_back(p, amount);
+  }
+
+	/**
+	 * @brief Get the last published state; fetching it and querying it take no locks, and it stays valid while it is held.
+	 *
+	 * @return Snapshot The published Bestsellers.
+	 */
+  Snapshot snapshot() const { return m_Snapshot.load(); }
+
+	/**
+	 * @brief Merge all buffered sales and publish the result before returning.
+	 */
+  void flush() { lock_guard<mutex> lock(m_MergeMutex); merge(); }
+
+private:
+  using Buffer = Bestsellers<Product, Tree>;
+
+  /**
+   * @brief Sales of one writer thread not merged yet; its mutex is only ever contended by the merger.
+   */
+  struct alignas(64) DeltaBuffer {
+    mutex m_Mutex; vector<pair<Product, size_t>> m_Sales;
   };
 
-  ProductTree m_Shop;
+  /**
+   * @brief Slot the last reader of a published Bestsellers hands it back to, together with the number of merges it holds.
+   */
+  struct Spare {
+    explicit Spare(unique_ptr<Buffer> buffer) : m_Buffer(move(buffer)) {}
+
+    mutex m_Mutex; unique_ptr<Buffer> m_Buffer; size_t m_Merges = 0;
+  };
+
+  chrono::milliseconds m_Staleness; uint64_t m_Id; mutex m_BuffersMutex; vector<shared_ptr<DeltaBuffer>> m_Buffers;
+  shared_ptr<Spare> m_Spare; vector<pair<Product, size_t>> m_Batch; size_t m_Merges;
+  AtomicSharedPtr<const Buffer> m_Snapshot; mutex m_MergeMutex;
+  mutex m_StopMutex; condition_variable m_Wake; bool m_Stop; thread m_Merger;
+
+	/**
+	 * @brief Get a new object id, never reused, which keys the delta buffers of the object in the threads.
+	 *
+	 * @return uint64_t The id.
+	 */
+  static uint64_t get_id() { static atomic<uint64_t> ids(0); return ids++; }
+
+	/**
+	 * @brief Get the delta buffer of the calling thread, creating and registering it on the first sale of the thread.
+	 *
+	 * Each thread maps object ids to its buffers; those the objects have released are dropped whenever it registers one.
+	 *
+	 * @return DeltaBuffer& The buffer.
+	 */
+  DeltaBuffer& get_buffer()
+  {
+    static thread_local unordered_map<uint64_t, shared_ptr<DeltaBuffer>> buffers;
+    auto it = buffers.find(m_Id);
+    if (it != buffers.end()) return *it->second;
+
+    for (auto released = buffers.begin(); released != buffers.end(); )
+      released = released->second.use_count() == 1 ? buffers.erase(released) : next(released);
+
+    auto buffer = make_shared<DeltaBuffer>();
+    { lock_guard<mutex> lock(m_BuffersMutex); m_Buffers.push_back(buffer); }
+    return *buffers.emplace(m_Id, move(buffer)).first->second;
+  }
+
+	/**
+	 * @brief Wrap a Bestsellers into a snapshot that hands it back to the spare slot once its last reader drops it.
+	 *
+	 * The slot keeps the most recent of the buffers handed back; the deleter owns the slot as well, so snapshots may
+	 * outlive the object.
+	 *
+	 * @param buffer The Bestsellers.
+	 * @param merges The number of merges it holds.
+	 * @return Snapshot The snapshot.
+	 */
+  Snapshot publish(unique_ptr<Buffer> buffer, size_t merges)
+  {
+    return Snapshot(buffer.release(), [spare = m_Spare, merges](const Buffer *retired) {
+      unique_ptr<Buffer> buffer(const_cast<Buffer*>(retired));
+      lock_guard<mutex> lock(spare->m_Mutex);
+      if (!(spare->m_Buffer) || spare->m_Merges < merges) { spare->m_Buffer.swap(buffer); spare->m_Merges = merges; }
+    });
+  }
+
+	/**
+	 * @brief Fold the delta buffers into the spare Bestsellers, or a copy of the published one, and publish it if anything
+	 * changed.
+	 */
+  void merge()
+  {
+    vector<pair<Product, size_t>> sales, salesBuffer;
+    {
+      lock_guard<mutex> lock(m_BuffersMutex);
+      for (auto &buffer : m_Buffers)
+      {
+        { lock_guard<mutex> lockBuffer(buffer->m_Mutex); salesBuffer.swap(buffer->m_Sales); }
+        move(salesBuffer.begin(), salesBuffer.end(), back_inserter(sales)); salesBuffer.clear();
+      }
+    }
+    if (sales.empty()) return;
+
+    unique_ptr<Buffer> buffer; size_t merges;
+    { lock_guard<mutex> lock(m_Spare->m_Mutex); buffer = move(m_Spare->m_Buffer); merges = m_Spare->m_Merges; }
+    if (buffer && merges + 1 == m_Merges) buffer->sell_batch(m_Batch.begin(), m_Batch.end());
+    else if (!buffer || merges != m_Merges) buffer = make_unique<Buffer>(*m_Snapshot.load());
+    buffer->sell_batch(sales.begin(), sales.end());
+
+    m_Batch = move(sales);
+    m_Snapshot.exchange(publish(move(buffer), ++m_Merges));
+  }
+
+	/**
+	 * @brief Merge every staleness period until the object is destroyed.
+	 */
+  void run_merger()
+  {
+    unique_lock<mutex> lock(m_StopMutex);
+    while (!(m_Wake.wait_for(lock, m_Staleness, [this]() { return m_Stop; }))) { lock.unlock(); flush(); lock.lock(); }
+  }
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -535,13 +3577,599 @@ void test2() {
   CATCH(T.sold(3, 2));
   CATCH(T.sold(1, 9));
 
+  Bestsellers<std::string> E;
+  assert(E.products() == 0);
+  CATCH(E.product(1));
+  CATCH(E.sold(1, 1));
+
 #undef CATCH
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+
+template < template < typename > class Tree >
+void test3() {
+  Bestsellers<int, Tree> T; unordered_map<int, size_t> counts;
+  mt19937 generator(42); uniform_int_distribution<int> products(0, 199), amounts(1, 3);
+
+  for (int i = 0; i < 20000; ++i)
+  {
+    int p = products(generator); size_t amount = amounts(generator);
+    T.sell(p, amount); counts[p] += amount;
+
+    if (i % 997) continue;
+
+    vector<size_t> sorted; for (const auto& c : counts) sorted.push_back(c.second);
+    sort(sorted.rbegin(), sorted.rend());
+
+    assert(T.products() == counts.size());
+    for (size_t r = 1; r <= sorted.size(); ++r)
+    {
+      assert(T.sold(r) == sorted[r - 1]);
+      assert(T.rank(T.product(r)) == r);
+      assert(counts.at(T.product(r)) == sorted[r - 1]);
+    }
+    assert(T.sold(1, sorted.size()) == accumulate(sorted.begin(), sorted.end(), size_t(0)));
+    if (sorted.size() >= 17) assert(T.sold(3, 17) == accumulate(sorted.begin() + 2, sorted.begin() + 17, size_t(0)));
+  }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+template < template < typename > class Tree >
+void test4() {
+  Bestsellers<std::string, Tree> T;
+  for (int i = 0; i < 5000; ++i) T.sell("item" + to_string(i), 1);
+  for (int i = 0; i < 5000; i += 2) T.sell("item" + to_string(i), 1);
+
+  assert(T.first_same(1) == 1 && T.last_same(1) == 2500);
+  assert(T.first_same(2501) == 2501 && T.last_same(5000) == 5000);
+  for (size_t r = 1; r <= 5000; ++r) assert(T.rank(T.product(r)) == r);
+  assert(T.sold(2500, 2501) == 3);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+template < template < typename > class Tree >
+void test5() {
+  Bestsellers<int, Tree> T; unordered_map<int, size_t> counts;
+  mt19937 generator(5); uniform_int_distribution<int> amounts(0, 4);
+
+  for (size_t batch : {1000, 3, 50, 700, 10, 2000, 1, 400})
+  {
+    uniform_int_distribution<int> products(0, batch);
+    vector<pair<int, size_t>> sales;
+    for (size_t i = 0; i < batch; ++i) { sales.emplace_back(products(generator), amounts(generator)); counts[sales.back().first] += sales.back().second; }
+    T.sell_batch(sales.begin(), sales.end());
+
+    for (auto it = counts.begin(); it != counts.end(); ) it = it->second ? next(it) : counts.erase(it);
+    vector<size_t> sorted; for (const auto& c : counts) sorted.push_back(c.second);
+    sort(sorted.rbegin(), sorted.rend());
+
+    assert(T.products() == counts.size());
+    for (size_t r = 1; r <= sorted.size(); ++r)
+    {
+      assert(T.sold(r) == sorted[r - 1]);
+      assert(T.rank(T.product(r)) == r);
+      assert(counts.at(T.product(r)) == sorted[r - 1]);
+      assert(T.first_same(r) <= r && r <= T.last_same(r));
+    }
+    assert(T.sold(1, sorted.size()) == accumulate(sorted.begin(), sorted.end(), size_t(0)));
+  }
+
+  size_t products = T.products(); vector<pair<int, size_t>> zeros = {{-2, 0}, {-1, 0}};
+  T.sell(-1, 0); T.sell_batch(zeros.begin(), zeros.end());
+  assert(T.products() == products);
+  try { T.rank(-1); assert(0); } catch (const out_of_range&) {}
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test6() {
+  ConcurrentBestsellers<int> T(chrono::milliseconds(1));
+  atomic<bool> done(false);
+
+  thread reader([&]() {
+    size_t soldLast = 0;
+    while (!done)
+    {
+      auto S = T.snapshot(); size_t products = S->products();
+      if (!products) continue;
+      size_t sold = S->sold(1, products);
+      assert(sold >= soldLast); soldLast = sold;
+      assert(S->rank(S->product(products)) == products && S->sold(1) >= S->sold(products));
+    }
+  });
+
+  vector<thread> writers;
+  for (int w = 0; w < 4; ++w) writers.emplace_back([&T, w]() { for (int i = 0; i < 20000; ++i) T.sell((i * 7 + w) % 500, 1 + w); });
+  for (auto &writer : writers) writer.join();
+  T.flush(); done = true; reader.join();
+
+  auto S = T.snapshot();
+  assert(S->products() == 500);
+  assert(S->sold(1, 500) == 20000 * (1 + 2 + 3 + 4));
+
+  ConcurrentBestsellers<int> U(chrono::hours(1));
+  U.sell(1, 5); U.flush(); auto A = U.snapshot();
+  U.sell(2, 3); U.flush(); U.sell(1, 1); U.flush(); U.sell(3, 9); U.flush();
+  auto B = U.snapshot();
+  assert(A->products() == 1 && A->sold(1) == 5);
+  assert(B->products() == 3 && B->product(1) == 3 && B->sold(2) == 6 && B->sold(3) == 3);
+
+  A.reset(); B.reset();
+  for (int i = 0; i < 5; ++i) { U.sell(i, 10); U.flush(); }
+  auto C = U.snapshot();
+  assert(C->products() == 5 && C->sold(1, 5) == 68 && C->product(1) == 3 && C->sold(2) == 16);
+
+  // A thread keeps one buffer per object and drops those of destroyed objects
+  { ConcurrentBestsellers<int> W(chrono::hours(1)); W.sell(7, 2); W.flush(); assert(W.snapshot()->sold(1) == 2); }
+  ConcurrentBestsellers<int> X(chrono::hours(1)); X.sell(8, 3); U.sell(9, 1); X.flush(); U.flush();
+  assert(X.snapshot()->products() == 1 && X.snapshot()->sold(1) == 3 && U.snapshot()->rank(9) == 6);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test7() {
+  Bestsellers<std::string, PersistentProductTree> T;
+  T.sell("coke", 32);
+  T.sell("bread", 1);
+  T.sell("ham", 2);
+  T.sell("mushrooms", 12);
+
+  auto S = T.snapshot();
+  T.sell("ham", 11);
+  T.sell("bread", 100);
+  T.sell("milk", 5);
+
+  assert(S.version() == 4 && S.products() == 4);
+  assert(S.product(2) == "mushrooms" && S.sold(3) == 2 && S.sold(1, 3) == 46);
+  assert(T.products() == 5 && T.product(1) == "bread" && T.product(3) == "ham" && T.sold(1, 3) == 146);
+
+  auto R = T.snapshot();
+  S = R;
+  assert(S.version() == 7 && S.sold(1, 5) == 163);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+template < template < typename > class Tree >
+void test8() {
+  Bestsellers<int, Tree> T;
+  assert(T.begin() == T.end() && T.top(10).begin() == T.top(10).end());
+
+  mt19937 generator(8); uniform_int_distribution<int> products(0, 2999), amounts(1, 9);
+  for (int i = 0; i < 30000; ++i) T.sell(products(generator), amounts(generator));
+
+  size_t r = 1;
+  for (auto [p, sold] : T) { assert(p == T.product(r) && sold == T.sold(r)); ++r; }
+  assert(r == T.products() + 1);
+
+  r = 1;
+  for (auto [p, sold] : T.top(100)) { assert(p == T.product(r) && sold == T.sold(r)); ++r; }
+  assert(r == 101);
+
+  auto it = T.begin(T.products() - 2); assert(it.rank() == T.products() - 2);
+  assert((*it).second == T.sold(T.products() - 2) && ++it != T.end() && ++it != T.end() && ++it == T.end());
+}
+
+template < template < typename > class Tree >
+void test9() {
+  using Clock = WindowedBestsellers<int>::Clock;
+  static_assert(!(is_convertible<WindowedBestsellers<int, Tree>*, Bestsellers<int, Tree>*>::value), "sales must not bypass the window");
+  WindowedBestsellers<int, Tree> T(chrono::seconds(10), 10);
+  vector<tuple<int64_t, int, size_t>> sales;
+
+  mt19937 generator(9); uniform_int_distribution<int> products(0, 199), amounts(1, 5), steps(0, 99);
+  int64_t now = 1000;
+  for (int i = 0; i < 20000; ++i)
+  {
+    int step = steps(generator); now += (step < 90) ? 0 : (step < 99) ? 1 : 7;
+    int p = products(generator); size_t amount = amounts(generator);
+    T.sell(p, amount, Clock::time_point(chrono::seconds(now))); sales.emplace_back(now, p, amount);
+
+    if (i % 500) continue;
+    unordered_map<int, size_t> model;
+    for (const auto &[when, q, sold] : sales) if (when > now - 10) model[q] += sold;
+    assert(T.products() == model.size());
+    for (const auto &[q, sold] : model) assert(T.sold(T.rank(q)) == sold);
+    for (size_t r = 1; r < T.products(); ++r) assert(T.sold(r) >= T.sold(r + 1));
+  }
+
+  size_t uniques = T.products(), total = T.sold(1, uniques);
+  T.sell(0, 1, Clock::time_point(chrono::seconds(now - 10)));
+  assert(T.products() == uniques && T.sold(1, uniques) == total);
+  T.expire(Clock::time_point(chrono::seconds(now + 9)));
+  assert(T.products() <= 200);
+  T.expire(Clock::time_point(chrono::seconds(now + 10)));
+  assert(T.products() == 0);
+  try { T.rank(0); assert(0); } catch (const out_of_range&) {}
+}
+
+template < template < typename > class Tree >
+void test10() {
+  static_assert(!(is_convertible<ApproximateBestsellers<int, Tree>*, Bestsellers<int, Tree>*>::value), "sales must not bypass the eviction");
+  ApproximateBestsellers<int, Tree> T(500);
+  unordered_map<int, size_t> model;
+
+  mt19937 generator(10); uniform_real_distribution<double> skew(0.0, 1.0); uniform_int_distribution<int> amounts(1, 3);
+  for (int i = 0; i < 100000; ++i)
+  {
+    int p = static_cast<int>(pow(skew(generator), 4) * 100000); size_t amount = amounts(generator);
+    T.sell(p, amount); model[p] += amount;
+    assert(T.products() <= T.capacity());
+  }
+
+  assert(T.products() == T.capacity() && T.max_error() > 0);
+  for (size_t r = 1; r <= T.products(); ++r)
+  {
+    size_t sold = model[T.product(r)];
+    assert(sold <= T.sold(r) && sold + T.error(r) >= T.sold(r));
+    if (r < T.products()) assert(T.sold(r) >= T.sold(r + 1));
+  }
+  for (const auto &[p, sold] : model) if (sold > T.max_error()) assert(T.sold(T.rank(p)) >= sold);
+  assert(T.product(1) == 0 && T.error(1) == 0);
+}
+
+void test11() {
+  using Clock = WindowedBestsellers<std::string>::Clock;
+  WindowedBestsellers<std::string, PersistentProductTree> T(chrono::seconds(10), 10);
+  T.sell("coke", 3, Clock::time_point(chrono::seconds(100)));
+  T.sell("bread", 1, Clock::time_point(chrono::seconds(105)));
+  const std::string *coke = &T.product(1), *bread = &T.product(2);
+
+  optional<WindowedBestsellers<std::string, PersistentProductTree>::Snapshot> S = T.snapshot();
+  T.expire(Clock::time_point(chrono::seconds(110)));
+  T.sell("ham", 2, Clock::time_point(chrono::seconds(110)));
+  assert(T.products() == 2 && &T.product(T.rank("ham")) != coke && S->product(1) == "coke" && S->product(2) == "bread");
+
+  S.reset();
+  T.expire(Clock::time_point(chrono::seconds(115)));
+  T.sell("milk", 5, Clock::time_point(chrono::seconds(115)));
+  assert(T.products() == 2 && (&T.product(1) == coke || &T.product(1) == bread) && T.product(1) == "milk" && T.product(2) == "ham");
+
+  WindowedBestsellers<std::string, PersistentProductTree> U = T;
+  U.sell("ham", 10, Clock::time_point(chrono::seconds(116))); U.sell("eggs", 1, Clock::time_point(chrono::seconds(116)));
+  assert(U.product(1) == "ham" && U.rank("eggs") == 3 && T.product(1) == "milk" && T.products() == 2);
+  try { T.rank("coke"); assert(0); } catch (const out_of_range&) {}
+}
+
+template < template < typename > class Tree >
+void test12() {
+  Bestsellers<std::string, Tree> T, U;
+  assert(T.save("test12.bin") && U.load("test12.bin") && U.products() == 0);
+
+  mt19937 generator(12); uniform_int_distribution<int> products(0, 4999), amounts(1, 9);
+  for (int i = 0; i < 40000; ++i) T.sell("product " + to_string(products(generator)), amounts(generator));
+  T.sell("zero", 0); U.sell("stale", 1);
+
+  assert(T.save("test12.bin") && U.load("test12.bin") && U.products() == T.products() && !(ifstream("test12.bin.tmp")));
+  for (size_t r = 1; r <= T.products(); ++r) assert(U.product(r) == T.product(r) && U.sold(r) == T.sold(r) && U.rank(T.product(r)) == r);
+  assert(U.sold(1, U.products()) == T.sold(1, T.products()));
+  U.sell("product 7", 1000); U.sell("new", 2000);
+  assert(U.product(1) == "new" && U.product(2) == "product 7" && U.products() == T.products() + 1);
+
+  { ofstream out("test12.bin", ios::binary | ios::app); out << "junk"; }
+  assert(!(U.load("test12.bin")) && U.product(1) == "new");
+  assert(!(U.load("test12.missing")) && !(T.save("test12.missing/test12.bin")));
+  remove("test12.bin");
+
+  if constexpr (is_same<Tree<int>, PersistentProductTree<int>>::value)
+  {
+    auto S = U.snapshot();
+    assert(T.save("test12.bin") && U.load("test12.bin") && U.product(1) != "new");
+    assert(S.product(1) == "new" && S.product(2) == "product 7" && S.products() == U.products() + 1);
+    remove("test12.bin");
+  }
+
+  Bestsellers<int, Tree> V, W;
+  for (int i = 0; i < 1000; ++i) V.sell(i % 97, i % 7 + 1);
+  assert(V.save("test12.bin") && W.load("test12.bin") && W.products() == 97);
+  for (size_t r = 1; r <= V.products(); ++r) assert(W.product(r) == V.product(r) && W.sold(r) == V.sold(r));
+  remove("test12.bin");
+
+  // The products stay in the mapping, indexed by the first lookups (racing here), and their IDs are not recycled
+  thread reader([&]() { assert(W.rank(V.product(3)) == 3); });
+  assert(W.rank(V.product(4)) == 4); reader.join();
+  vector<pair<int, size_t>> sold = {{V.product(1), V.sold(1)}};
+  W.unsell_batch(sold.begin(), sold.end()); W.sell(1000, 1); W.sell(1001, 500);
+  Bestsellers<int, Tree> X = W; W = Bestsellers<int, Tree>();
+  assert(X.products() == 98 && X.product(1) == 1001 && X.sold(2) == V.sold(2) && X.rank(1000) == 98);
+  try { X.rank(V.product(1)); assert(0); } catch (const out_of_range&) {}
+}
+
+template < template < typename > class Tree >
+void test13() {
+  vector<pair<int, size_t>> sales; unordered_map<int, size_t> model;
+  mt19937 generator(13); uniform_int_distribution<int> products(0, 59999), amounts(0, 50);
+  for (int i = 0; i < 150000; ++i) { sales.emplace_back(products(generator), amounts(generator)); if (sales.back().second) model[sales.back().first] += sales.back().second; }
+
+  Bestsellers<int, Tree> T(sales.begin(), sales.end());
+  assert(T.products() == model.size());
+  for (size_t r = 1; r <= T.products(); ++r) { assert(T.sold(r) == model[T.product(r)] && T.rank(T.product(r)) == r); if (r > 1) assert(T.sold(r - 1) >= T.sold(r)); }
+
+  T.sell(7, 100000); T.sell(-1, 5);
+  assert(T.product(1) == 7 && T.products() == model.size() + 1);
+
+  list<pair<std::string, size_t>> exported = {{"ham", 2}, {"coke", 30}, {"ham", 11}, {"bread", 0}, {"milk", 13}};
+  Bestsellers<std::string, Tree> U; U.sell("stale", 1); U.assign(exported.begin(), exported.end());
+  assert(U.products() == 3 && U.product(1) == "coke" && U.sold(2, 3) == 26 && U.first_same(3) == 2);
+  try { U.rank("stale"); assert(0); } catch (const out_of_range&) {}
+
+  if constexpr (is_same<Tree<int>, PersistentProductTree<int>>::value)
+  {
+    // A snapshot keeps the table it was taken with, even once the Bestsellers is reassigned and destroyed
+    auto S = [&]() {
+      Bestsellers<std::string, Tree> V; V.sell("old", 5); V.sell("older", 3);
+      auto R = V.snapshot(); V.assign(exported.begin(), exported.end());
+      assert(V.product(1) == "coke" && R.product(1) == "old");
+      return R;
+    }();
+    assert(S.products() == 2 && S.product(1) == "old" && S.product(2) == "older" && S.sold(1, 2) == 8);
+  }
+
+  vector<size_t> values(200000); for (auto &value : values) value = amounts(generator);
+  parallel_sort(values.begin(), values.end(), greater<size_t>(), 4); assert(is_sorted(values.begin(), values.end(), greater<size_t>()));
+}
+
+template < template < typename > class Tree >
+void test14() {
+  Bestsellers<int, Tree> T;
+  try { T.cover(0.8); assert(0); } catch (const out_of_range&) {}
+  try { T.quantile(0.5); assert(0); } catch (const out_of_range&) {}
+  assert(T.at_least(1) == 0);
+
+  mt19937 generator(14); uniform_int_distribution<int> products(0, 1999), amounts(1, 20);
+  for (int round = 0; round < 20; ++round)
+  {
+    for (int i = 0; i < 2000; ++i) T.sell(products(generator) / (1 + round % 3), amounts(generator));
+
+    vector<size_t> counts; for (auto [p, sold] : T) counts.push_back(sold);
+    size_t total = accumulate(counts.begin(), counts.end(), size_t(0));
+    for (double share : {0.01, 0.5, 0.8, 0.95, 1.0})
+    {
+      size_t units = ceil(share * total), r = 1, prefix = counts[0];
+      while (prefix < units) prefix += counts[r++];
+      assert(T.cover(share) == r);
+    }
+    for (size_t amount : {size_t(0), size_t(1), counts.back(), counts[counts.size() / 2], counts[0], counts[0] + 1})
+      assert(T.at_least(amount) == size_t(count_if(counts.begin(), counts.end(), [&](size_t c) { return c >= amount; })));
+    for (double p : {0.0, 0.1, 0.5, 0.9, 1.0})
+    {
+      size_t below = max<size_t>(ceil(p * counts.size()), 1);
+      assert(T.quantile(p) == counts[counts.size() - below]);
+    }
+  }
+  assert(T.quantile(1) == T.sold(1) && T.quantile(0) == T.sold(T.products()) && T.cover(1) <= T.products());
+  try { T.cover(1.5); assert(0); } catch (const out_of_range&) {}
+}
+
+template < template < typename > class Tree >
+void test15() {
+  MultiBestsellers<std::string, int, Tree> M; vector<Bestsellers<std::string, Tree>> boards(4);
+  mt19937 generator(15); uniform_int_distribution<int> products(0, 299), amounts(1, 9), subsets(1, 15);
+  for (int i = 0; i < 20000; ++i)
+  {
+    std::string p = "product " + to_string(products(generator)); size_t amount = amounts(generator); int subset = subsets(generator);
+    vector<int> ids; for (int board = 0; board < 4; ++board) if (subset & (1 << board)) { ids.push_back(board); boards[board].sell(p, amount); }
+    M.sell(p, amount, ids.begin(), ids.end());
+  }
+  M.sell("coke", 5000, {0, 2, 0}); M.sell("zero", 0, {1}); M.sell("none", 3, {});
+
+  assert(M.boards() == 4);
+  for (int board = 0; board < 4; ++board)
+  {
+    if (!(board % 2)) { boards[board].sell("coke", 5000); assert(M.product(board, 1) == "coke"); }
+    assert(M.products(board) == boards[board].products());
+    for (size_t r = 1; r <= M.products(board); ++r) assert(M.sold(board, r) == boards[board].sold(r) && M.sold(board, M.rank(board, M.product(board, r))) == M.sold(board, r));
+    assert(M.sold(board, 1, M.products(board)) == boards[board].sold(1, boards[board].products()));
+  }
+  assert(&M.product(0, 1) == &M.product(2, 1) && M.first_same(1, M.last_same(1, 1)) == 1);
+
+  size_t r = 1;
+  for (auto [p, sold] : M.top(3, 10)) { assert(p == M.product(3, r) && sold == M.sold(3, r)); ++r; }
+  assert(r == 11);
+  try { M.products(7); assert(0); } catch (const out_of_range&) {}
+  try { M.rank(1, "coke"); assert(0); } catch (const out_of_range&) {}
+  try { M.rank(1, "zero"); assert(0); } catch (const out_of_range&) {}
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+#ifdef BESTSELLERS_STATS
+void test16() {
+  ProductTree<int> T;
+  for (int i = 0; i < 1000; ++i) T.insert_node(i, 1 + i % 10);
+  vector<thread> readers;
+  for (int t = 0; t < 2; ++t) readers.emplace_back([&T]() { for (int i = 0; i < 1000; ++i) T.get_rank(i); });
+  for (auto &reader : readers) reader.join();
+  T.get_sold(1, 10);
+
+  auto stats = T.get_stats();
+  assert(stats.m_Rotations > 0 && stats.m_Allocations > 0 && stats.m_Rebuilds == 0);
+  assert(stats.m_Height == 4 && stats.m_Buckets[6] == 10);
+  assert(stats.m_Calls[decltype(stats)::INSERT] == 1000 && stats.m_Calls[decltype(stats)::RANK] == 2000 && stats.m_Calls[decltype(stats)::SOLD_RANGE] == 1);
+  vector<pair<int, size_t>> ranked = {{1, 5}};
+  T.assign_ranked(ranked);
+  assert(T.get_stats().m_Height == 4 && T.get_stats().m_Buckets[0] == 1);
+
+  Bestsellers<int> U;
+  for (int i = 0; i < 1000; ++i) U.sell(i, 1);
+  assert(U.get_table_stats().m_Rehashes > 0 && U.get_stats().m_Calls[decltype(stats)::INSERT] == 1000);
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+#ifdef BESTSELLERS_BENCHMARK
+# ifndef BESTSELLERS_BENCHMARK_OPERATIONS
+#  define BESTSELLERS_BENCHMARK_OPERATIONS 100000000
+# endif
+
+/**
+ * @brief Source of products sold in the benchmark.
+ *
+ * ZIPFIAN draws product k with probability proportional to 1 / k, UNIFORM draws every product equally often and TIES
+ * sells the products round-robin, so that after every round all of them share one tie bucket.
+ */
+class SaleDistribution {
+public:
+  enum Kind { ZIPFIAN, UNIFORM, TIES };
+
+  SaleDistribution(Kind kind, size_t products, uint32_t seed) : m_Kind(kind), m_Products(products), m_Next(0), m_Generator(seed), m_Cdf()
+  {
+    if (kind != ZIPFIAN) return;
+
+    m_Cdf.reserve(products); double sum = 0;
+    for (size_t k = 1; k <= products; ++k) m_Cdf.push_back(sum += 1.0 / k);
+    for (double &cdf : m_Cdf) cdf /= sum;
+  }
+
+  size_t operator()()
+  {
+    if (m_Kind == TIES) { m_Next = (m_Next + 1 == m_Products) ? 0 : m_Next + 1; return m_Next; }
+    if (m_Kind == UNIFORM) return uniform_int_distribution<size_t>(0, m_Products - 1)(m_Generator);
+
+    double u = uniform_real_distribution<double>(0.0, 1.0)(m_Generator);
+    return min<size_t>(lower_bound(m_Cdf.begin(), m_Cdf.end(), u) - m_Cdf.begin(), m_Products - 1);
+  }
+
+private:
+  Kind m_Kind; size_t m_Products, m_Next; mt19937_64 m_Generator; vector<double> m_Cdf;
+};
+
+/**
+ * @brief Run one phase of the benchmark and report its throughput and p99 latency.
+ *
+ * The inputs are generated in chunks outside the measured loops; the latency of every k-th operation is sampled so that
+ * at most about 100000 samples are kept.
+ *
+ * @param name The name of the backend and distribution.
+ * @param phase The name of the phase.
+ * @param operations The number of operations.
+ * @param generate Callback producing the input of one operation.
+ * @param run Callback executing one operation on its input.
+ */
+template < typename Generate, typename Run >
+void benchmark_phase(const string &name, const char *phase, size_t operations, Generate &&generate, Run &&run) {
+  static constexpr size_t CHUNK = 1 << 20;
+  size_t stride = max<size_t>(operations / 100000, 1);
+  vector<decltype(generate())> inputs; vector<uint64_t> samples; chrono::steady_clock::duration total(0);
+
+  for (size_t done = 0; done < operations; done += inputs.size())
+  {
+    inputs.clear();
+    for (size_t i = 0; i < min(CHUNK, operations - done); ++i) inputs.push_back(generate());
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+      if ((done + i) % stride) { run(inputs[i]); continue; }
+      auto before = chrono::steady_clock::now(); run(inputs[i]);
+      samples.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count());
+    }
+    total += chrono::steady_clock::now() - start;
+  }
+
+  auto p99 = samples.begin() + samples.size() * 99 / 100; nth_element(samples.begin(), p99, samples.end());
+  double seconds = chrono::duration<double>(total).count();
+  cout << name << "\t" << operations << "\t" << phase << "\t" << operations / seconds / 1e6 << " Mops/s\tp99 " << *p99 << " ns" << endl;
+}
+
+/**
+ * @brief Drive Bestsellers on one backend with one sale distribution: sales, then product, sold, rank and range queries.
+ *
+ * @tparam Tree The ranking structure backing the products.
+ * @param backend The name of the backend.
+ * @param kind The sale distribution.
+ * @param operations The number of operations per phase.
+ */
+template < template < typename > class Tree >
+void benchmark_backend(const char *backend, SaleDistribution::Kind kind, size_t operations) {
+  static const char *KINDS[] = {"zipfian", "uniform", "ties"};
+  string name = string(backend) + "\t" + KINDS[kind];
+  size_t products = min<size_t>(max<size_t>(operations / 10, 1), 1000000), checksum = 0;
+
+  Bestsellers<size_t, Tree> T; SaleDistribution sales(kind, products, 7); mt19937_64 generator(8);
+  benchmark_phase(name, "sell", operations, sales, [&](size_t p) { T.sell(p, 1); });
+
+  uniform_int_distribution<size_t> ranks(1, T.products());
+  benchmark_phase(name, "product", operations, [&]() { return ranks(generator); }, [&](size_t r) { checksum += T.product(r); });
+  benchmark_phase(name, "sold", operations, [&]() { return ranks(generator); }, [&](size_t r) { checksum += T.sold(r); });
+  benchmark_phase(name, "rank", operations, [&]() { return T.product(ranks(generator)); }, [&](size_t p) { checksum += T.rank(p); });
+  benchmark_phase(name, "sold range", operations, [&]() { size_t a = ranks(generator), b = ranks(generator); return make_pair(min(a, b), max(a, b)); },
+                  [&](pair<size_t, size_t> range) { checksum += T.sold(range.first, range.second); });
+
+#ifdef BESTSELLERS_STATS
+  if constexpr (is_same<typename Bestsellers<size_t, Tree>::Shop, ProductTree<uint32_t>>::value)
+  {
+    auto stats = T.get_stats();
+    cout << name << "\tstats\trotations " << stats.m_Rotations << ", allocations " << stats.m_Allocations << ", rehashes " << T.get_table_stats().m_Rehashes
+         << ", height " << stats.m_Height << ", largest tie bucket < 2^" << (stats.m_Buckets.rend() - find_if(stats.m_Buckets.rbegin(), stats.m_Buckets.rend(), [](size_t b) { return b; })) << endl;
+  }
+#endif
+
+  if (!checksum) cout << endl;
+}
+
+/**
+ * @brief Compare the AVL and the B+-tree backends on all sale distributions, from 10^4 operations per phase up to
+ * BESTSELLERS_BENCHMARK_OPERATIONS.
+ */
+void benchmark() {
+  for (size_t operations = 10000; operations <= BESTSELLERS_BENCHMARK_OPERATIONS; operations *= 10)
+    for (auto kind : {SaleDistribution::ZIPFIAN, SaleDistribution::UNIFORM, SaleDistribution::TIES})
+    {
+      benchmark_backend<ProductTree>("AVL", kind, operations);
+      benchmark_backend<ProductBTree>("B+", kind, operations);
+    }
+}
+#endif
+
 // ---------------------------------------------------------------------------------------------------------------------
 // ---------------------------------------------------------------------------------------------------------------------
 
 int main() {
   test1();
   test2();
+  test3<ProductTree>();
+  test3<ProductBTree>();
+  test4<ProductTree>();
+  test4<ProductBTree>();
+  test5<ProductTree>();
+  test5<ProductBTree>();
+  test6();
+  test3<PersistentProductTree>();
+  test4<PersistentProductTree>();
+  test5<PersistentProductTree>();
+  test7();
+  test8<ProductTree>();
+  test8<ProductBTree>();
+  test8<PersistentProductTree>();
+  test9<ProductTree>();
+  test9<ProductBTree>();
+  test9<PersistentProductTree>();
+  test10<ProductTree>();
+  test10<ProductBTree>();
+  test10<PersistentProductTree>();
+  test11();
+  test12<ProductTree>();
+  test12<ProductBTree>();
+  test12<PersistentProductTree>();
+  test13<ProductTree>();
+  test13<ProductBTree>();
+  test13<PersistentProductTree>();
+  test14<ProductTree>();
+  test14<ProductBTree>();
+  test14<PersistentProductTree>();
+  test15<ProductTree>();
+  test15<ProductBTree>();
+  test15<PersistentProductTree>();
+#ifdef BESTSELLERS_STATS
+  test16();
+#endif
+
+#ifdef BESTSELLERS_BENCHMARK
+  benchmark();
+#endif
 }
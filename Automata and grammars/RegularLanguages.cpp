@@ -1,21 +1,28 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <deque>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <stack>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -45,32 +52,99 @@ struct DFA {
     std::set<State> m_FinalStates; // Set of final states
 };
 
+// ---------------------------------------------------------------------------------------------------------------------
+
+using Index = uint32_t;
+const Index NONE = numeric_limits<Index>::max(); // Missing transition (or unnamed state) in a compiled automaton
+
+// Compiled NFA: states renumbered to 0..n-1, symbols to 0..k-1, transitions in CSR form indexed by state × symbol
+struct CompiledNFA {
+	vector<Symbol> m_Alphabet; // Sorted alphabet, symbol index -> symbol
+	Index m_StatesCount; // Number of states
+	vector<Index> m_Offsets; // Targets of (q, a) are m_Targets[m_Offsets[q * k + a] .. m_Offsets[q * k + a + 1]), n * k + 1 entries
+	vector<Index> m_Targets; // Concatenated sorted target lists
+	Index m_InitialState; // Initial state
+	vector<bool> m_FinalStates; // Final flag per state
+};
+
+// Compiled DFA: states renumbered to 0..n-1, symbols to 0..k-1, flat transition table indexed by state × symbol
+struct CompiledDFA {
+	vector<Symbol> m_Alphabet; // Sorted alphabet, symbol index -> symbol
+	Index m_StatesCount; // Number of states
+	vector<Index> m_Transitions; // Target of (q, a) is m_Transitions[q * k + a], NONE if undefined
+	Index m_InitialState; // Initial state
+	vector<bool> m_FinalStates; // Final flag per state
+};
+
+// How unify and intersect combine their operands
+enum class Pipeline {
+	AUTOMATIC, // Choose by the size and nondeterminism of the operands
+	PRODUCT_FIRST, // Determinize the parallel run of the operands
+	DETERMINIZE_FIRST // Determinize and minimize each operand, then build the product of the DFAs
+};
+
 // ---------------------------------------------------------------------------------------------------------------------
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief Makes the given NFA complete by adding a "fail" state to handle missing transitions.
+ * @brief Compiles an NFA into the dense form over the given alphabet.
  *
  * @param nfa The input NFA.
- * @param alphabetSecond The alphabet of the second NFA.
- * @return NFA The complete NFA.
+ * @param alphabet The alphabet of the compiled NFA, a superset of the alphabet of the input NFA.
+ * @return CompiledNFA The compiled NFA.
  */
-NFA make_complete(const NFA& nfa, const set<Symbol>& alphabetSecond)
+CompiledNFA compile(const NFA& nfa, const set<Symbol>& alphabet)
 {
-	set<Symbol> alphabetComplete = nfa.m_Alphabet; alphabetComplete.insert(alphabetSecond.begin(), alphabetSecond.end());
-	if (nfa.m_Transitions.size() == (nfa.m_States.size() * alphabetComplete.size())) return nfa;
+	vector<State> states(nfa.m_States.begin(), nfa.m_States.end()); size_t width = alphabet.size();
+	auto stateIndex = [&](State s) { return Index(lower_bound(states.begin(), states.end(), s) - states.begin()); };
+	Index symbolIndex[256]; { Index tmp = 0; for (const auto& a : alphabet) symbolIndex[a] = tmp++; }
+
+	CompiledNFA n {vector<Symbol>(alphabet.begin(), alphabet.end()), Index(states.size()), vector<Index>(states.size() * width + 1, 0), {}, stateIndex(nfa.m_InitialState), vector<bool>(states.size(), false)};
+	for (const auto& s : nfa.m_FinalStates) n.m_FinalStates[stateIndex(s)] = true;
 
-	NFA nfaComplete = nfa; nfaComplete.m_Alphabet = alphabetComplete; State fail = 9999; nfaComplete.m_States.insert(fail);
-	for (const auto& state : nfaComplete.m_States)
+	for (const auto& t : nfa.m_Transitions) n.m_Offsets[stateIndex(t.first.first) * width + symbolIndex[t.first.second] + 1] = t.second.size();
+	partial_sum(n.m_Offsets.begin(), n.m_Offsets.end(), n.m_Offsets.begin());
+
+	n.m_Targets.resize(n.m_Offsets.back());
+	for (const auto& t : nfa.m_Transitions)
 	{
-		for (const auto& symbol : nfaComplete.m_Alphabet)
+		Index tmp = n.m_Offsets[stateIndex(t.first.first) * width + symbolIndex[t.first.second]];
+		for (const auto& s : t.second) n.m_Targets[tmp++] = stateIndex(s);
+	}
+
+	return n;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Converts a compiled DFA back to a DFA, numbering the states in breadth-first order over the sorted alphabet.
+ *
+ * Undefined transitions are left out, so the numbering (and thus the result) is canonical for the language of a minimal DFA.
+ *
+ * @param d The compiled DFA.
+ * @return DFA The resulting DFA.
+ */
+DFA decompile(const CompiledDFA& d)
+{
+	size_t width = d.m_Alphabet.size();
+	vector<Index> statesNaming(d.m_StatesCount, NONE), statesToRun = {d.m_InitialState}; statesNaming[d.m_InitialState] = 0;
+	DFA dfa {{}, set<Symbol>(d.m_Alphabet.begin(), d.m_Alphabet.end()), {}, 0, {}};
+
+	for (Index run = 0; run < statesToRun.size(); ++run)
+	{
+		Index stateToRun = statesToRun[run];
+		dfa.m_States.insert(run); if (d.m_FinalStates[stateToRun]) dfa.m_FinalStates.insert(run);
+
+		for (size_t a = 0; a < width; ++a)
 		{
-			pair<State, Symbol> transition = make_pair(state, symbol);
-			if (!(nfa.m_Transitions.count(transition))) nfaComplete.m_Transitions.insert({transition, {fail}});
+			Index target = d.m_Transitions[stateToRun * width + a]; if (target == NONE) continue;
+			if (statesNaming[target] == NONE) { statesNaming[target] = statesToRun.size(); statesToRun.push_back(target); }
+			dfa.m_Transitions.insert(make_pair(make_pair(run, d.m_Alphabet[a]), statesNaming[target]));
 		}
 	}
 
-	return nfaComplete;
+	return dfa;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -78,252 +152,761 @@ NFA make_complete(const NFA& nfa, const set<Symbol>& alphabetSecond)
 /**
  * @brief Creates a parallel run NFA for unification or intersection.
  *
- * @param aComplete The first complete NFA.
- * @param bComplete The second complete NFA.
+ * The operands may be partial: a missing transition leads to an implicit dead state, written as NONE in the pairs. The
+ * run of unification continues on one operand alone, while intersection and pairs of two dead states are not explored.
+ *
+ * @param a The first NFA.
+ * @param b The second NFA, over the same alphabet.
  * @param type True for unification, false for intersection.
- * @return NFA The resulting NFA.
+ * @return CompiledNFA The resulting NFA.
  */
-NFA make_parallel_run(const NFA& aComplete, const NFA& bComplete, bool type)
+CompiledNFA make_parallel_run(const CompiledNFA& a, const CompiledNFA& b, bool type)
 {
-	queue<pair<State, State>> statesToRun; // state of Union, (state of A, state of B)
-	set<State> statesInitial, statesFinal, states; map<pair<State, State>, State> statesVisited; State tmp = 1;
-	set<Symbol> alphabet;
-	pair<State, State> stateUnified = { aComplete.m_InitialState, bComplete.m_InitialState };
-	map<pair<State, Symbol>, set<State>> transitions;
+	size_t width = a.m_Alphabet.size(); const Index dead[] = {NONE};
+	unordered_map<uint64_t, Index> statesVisited; vector<pair<Index, Index>> statesToRun; // state of run -> (state of A, state of B)
+	auto visit = [&](Index s1, Index s2)
+	{
+		auto it = statesVisited.emplace((uint64_t(s1) << 32) | s2, statesToRun.size());
+		if (it.second) statesToRun.emplace_back(s1, s2);
+		return it.first->second;
+	};
+	auto targets = [&](const CompiledNFA& n, Index s, size_t symbol)
+	{
+		if (s == NONE || n.m_Offsets[s * width + symbol] == n.m_Offsets[s * width + symbol + 1]) return make_pair(dead, dead + 1);
+		return make_pair(n.m_Targets.data() + n.m_Offsets[s * width + symbol], n.m_Targets.data() + n.m_Offsets[s * width + symbol + 1]);
+	};
 
-	alphabet = aComplete.m_Alphabet; states.insert(tmp); statesVisited.insert(make_pair(stateUnified, tmp));
-	statesToRun.push( stateUnified);
+	CompiledNFA p {a.m_Alphabet, 0, {0}, {}, visit(a.m_InitialState, b.m_InitialState), {}};
+	vector<Index> stateUnified;
 
-	while (!(statesToRun.empty()))
+	// States are numbered in the order they are discovered and run in the same order, so the CSR arrays are appended in order
+	for (Index run = 0; run < statesToRun.size(); ++run)
 	{
-		auto stateToRun = statesToRun.front();
+		auto stateToRun = statesToRun[run];
+		bool final1 = stateToRun.first != NONE && a.m_FinalStates[stateToRun.first], final2 = stateToRun.second != NONE && b.m_FinalStates[stateToRun.second];
+		p.m_FinalStates.push_back(type ? (final1 || final2) : (final1 && final2));
 
-		if (type)
+		for (size_t symbol = 0; symbol < width; ++symbol)
 		{
-			if (stateToRun.first == aComplete.m_InitialState || stateToRun.second == bComplete.m_InitialState) statesInitial.insert(statesVisited.at(stateToRun));
-			if (aComplete.m_FinalStates.count(stateToRun.first) || bComplete.m_FinalStates.count(stateToRun.second)) statesFinal.insert(statesVisited.at(stateToRun));
+			auto targets1 = targets(a, stateToRun.first, symbol), targets2 = targets(b, stateToRun.second, symbol); stateUnified.clear();
+			bool dead1 = targets1.first == dead, dead2 = targets2.first == dead;
+
+			if (type ? !(dead1 && dead2) : !(dead1 || dead2))
+				for (auto s1 = targets1.first; s1 != targets1.second; ++s1)
+					for (auto s2 = targets2.first; s2 != targets2.second; ++s2) stateUnified.push_back(visit(*s1, *s2));
+
+			sort(stateUnified.begin(), stateUnified.end()); stateUnified.erase(unique(stateUnified.begin(), stateUnified.end()), stateUnified.end());
+			p.m_Targets.insert(p.m_Targets.end(), stateUnified.begin(), stateUnified.end()); p.m_Offsets.push_back(p.m_Targets.size());
 		}
-		else
+	}
+
+	p.m_StatesCount = statesToRun.size();
+
+	return p;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Interned subsets of NFA states, stored back to back as bitsets and hashed by their 64-bit fingerprints
+struct SubsetTable {
+	size_t m_Words; // Words per subset
+	vector<uint64_t> m_Subsets; // Subset i is m_Subsets[i * m_Words .. (i + 1) * m_Words)
+	vector<uint64_t> m_Fingerprints; // Subset -> fingerprint
+	vector<Index> m_Slots; // Open addressing table of subsets, NONE if empty, its size a power of two
+
+	/**
+	 * @brief Creates an empty table.
+	 *
+	 * @param words The number of words per subset.
+	 */
+	explicit SubsetTable(size_t words) : m_Words(words), m_Slots(16, NONE) {}
+
+	/**
+	 * @brief Get the number of subsets.
+	 *
+	 * @return Index The number of subsets.
+	 */
+	Index size() const { return m_Fingerprints.size(); }
+
+	/**
+	 * @brief Get the words of a subset, valid until the next insertion.
+	 *
+	 * @param subset The subset.
+	 * @return const uint64_t* The words of the subset.
+	 */
+	const uint64_t *at(Index subset) const { return m_Subsets.data() + subset * m_Words; }
+
+	/**
+	 * @brief Reserve memory for a number of subsets.
+	 *
+	 * @param subsets The number of subsets.
+	 */
+	void reserve(size_t subsets) { m_Subsets.reserve(subsets * m_Words); m_Fingerprints.reserve(subsets); }
+
+	/**
+	 * @brief Get the number of slots of a table holding a number of subsets.
+	 *
+	 * @param subsets The number of subsets.
+	 * @return size_t The number of slots.
+	 */
+	static size_t get_slots(size_t subsets) { size_t slots = 16; while (2 * subsets > slots) slots *= 2; return slots; }
+
+	/**
+	 * @brief Find a subset, inserting it if it is not in the table yet.
+	 *
+	 * @param subset The words of the subset.
+	 * @return pair<Index, bool> The subset and whether it was inserted.
+	 */
+	pair<Index, bool> intern(const uint64_t *subset) { return intern(subset, get_fingerprint(subset, m_Words)); }
+
+	/**
+	 * @brief Find a subset, inserting it if it is not in the table yet.
+	 *
+	 * @param subset The words of the subset.
+	 * @param fingerprint The fingerprint of the subset.
+	 * @return pair<Index, bool> The subset and whether it was inserted.
+	 */
+	pair<Index, bool> intern(const uint64_t *subset, uint64_t fingerprint)
+	{
+		size_t mask = m_Slots.size() - 1;
+		for (size_t slot = fingerprint & mask; ; slot = (slot + 1) & mask)
 		{
-			if (stateToRun.first == aComplete.m_InitialState && stateToRun.second == bComplete.m_InitialState) statesInitial.insert(statesVisited.at(stateToRun));
-			if (aComplete.m_FinalStates.count(stateToRun.first) && bComplete.m_FinalStates.count(stateToRun.second)) statesFinal.insert(statesVisited.at(stateToRun));
+			Index tmp = m_Slots[slot];
+			if (tmp == NONE) break;
+			if (m_Fingerprints[tmp] == fingerprint && equal(subset, subset + m_Words, at(tmp))) return make_pair(tmp, false);
 		}
 
-		for (const auto& a : alphabet)
-		{
-			for (const auto& s1 : aComplete.m_Transitions.at({stateToRun.first, a}))
-			{
-				for (const auto& s2 : bComplete.m_Transitions.at({stateToRun.second, a}))
-				{
-					stateUnified = {s1, s2};
+		Index tmp = size(); m_Subsets.insert(m_Subsets.end(), subset, subset + m_Words); m_Fingerprints.push_back(fingerprint);
+		if (2 * size() > m_Slots.size()) m_Slots.assign(2 * m_Slots.size(), NONE);
+		else { place(tmp); return make_pair(tmp, true); }
 
-					if (!(statesVisited.count(stateUnified)))
-					{
-						statesVisited.insert(make_pair(stateUnified, ++tmp));
-						states.insert(statesVisited.at(stateUnified));
-						statesToRun.push(stateUnified);
-					}
+		for (Index s = 0; s < size(); ++s) place(s);
 
-					pair<State, Symbol> transition = make_pair(statesVisited.at(stateToRun), a);
-					transitions[transition].insert(statesVisited.at(stateUnified));
-				}
-			}
-		}
+		return make_pair(tmp, true);
+	}
+
+	/**
+	 * @brief Compute the fingerprint of a subset.
+	 *
+	 * @param subset The words of the subset.
+	 * @param words The number of words of the subset.
+	 * @return uint64_t The fingerprint.
+	 */
+	static uint64_t get_fingerprint(const uint64_t *subset, size_t words)
+	{
+		uint64_t fingerprint = 0x9E3779B97F4A7C15ull;
+		for (size_t w = 0; w < words; ++w) { fingerprint = (fingerprint ^ subset[w]) * 0xBF58476D1CE4E5B9ull; fingerprint ^= fingerprint >> 31; }
+
+		return fingerprint;
+	}
+
+  private:
+	/**
+	 * @brief Put a subset into the first free slot of its probe sequence.
+	 *
+	 * @param subset The subset.
+	 */
+	void place(Index subset)
+	{
+		size_t mask = m_Slots.size() - 1, slot = m_Fingerprints[subset] & mask;
+		while (m_Slots[slot] != NONE) slot = (slot + 1) & mask;
+		m_Slots[slot] = subset;
+	}
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Renumbers the states of a DFA in breadth-first order over the sorted alphabet, dropping unreachable states.
+ *
+ * @param d The input DFA.
+ * @return CompiledDFA The renumbered DFA.
+ */
+CompiledDFA make_canonical(const CompiledDFA& d)
+{
+	size_t width = d.m_Alphabet.size();
+	vector<Index> statesNaming(d.m_StatesCount, NONE), statesToRun = {d.m_InitialState}; statesNaming[d.m_InitialState] = 0;
+	CompiledDFA dCanonical {d.m_Alphabet, 0, {}, 0, {}};
 
-		statesToRun.pop();
+	for (Index run = 0; run < statesToRun.size(); ++run)
+	{
+		dCanonical.m_FinalStates.push_back(d.m_FinalStates[statesToRun[run]]);
+		for (size_t a = 0; a < width; ++a)
+		{
+			Index target = d.m_Transitions[statesToRun[run] * width + a];
+			if (target != NONE && statesNaming[target] == NONE) { statesNaming[target] = statesToRun.size(); statesToRun.push_back(target); }
+			dCanonical.m_Transitions.push_back(target == NONE ? NONE : statesNaming[target]);
+		}
 	}
 
-	State stateInitial = *statesInitial.begin();
+	dCanonical.m_StatesCount = statesToRun.size();
 
-	return NFA {states, alphabet, transitions, stateInitial, statesFinal};
+	return dCanonical;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+const uint64_t PARALLEL_STATES = 4096; // Fewest discovered states of an exploration worth spreading over threads
+
 /**
- * @brief Converts an NFA to a DFA.
+ * @brief Explores the DFA reachable from an initial state, each state given by a key of a fixed number of words.
  *
- * @param n The input NFA.
- * @return DFA The resulting DFA.
+ * The all-zero key stands for the dead state and becomes an undefined transition. The exploration starts sequentially
+ * and only spreads over more threads once it discovers more than PARALLEL_STATES states, so small automata never pay for
+ * them. Then each thread runs the states of its own deque and steals from the other deques when it runs dry, keys are
+ * interned in a table split into locked shards, and the result is renumbered canonically, so it is identical to the
+ * sequential one. An exception thrown by any thread stops the others and is rethrown once they are joined.
+ *
+ * @param alphabet The alphabet.
+ * @param words The number of words per key.
+ * @param initial The key of the initial state.
+ * @param expand Given a key, writes the keys of its successors on all symbols one after another and returns whether it is final.
+ * @param threads The number of threads to use, the calling one included.
+ * @return CompiledDFA The resulting DFA, its states numbered in breadth-first order.
  */
-DFA make_determined(const NFA& n)
+template <typename Expand>
+CompiledDFA make_explored(const vector<Symbol>& alphabet, size_t words, const uint64_t *initial, const Expand& expand, size_t threads)
 {
-	queue<set<State>> statesToRun;
-	set<State> states, statesFinal; map<set<State>, State> statesVisited; map<pair<State, Symbol>, State> transitions;
-	set<Symbol> alphabet = n.m_Alphabet; set<State> stateUnified = { n.m_InitialState }; State stateInitial, tmp = 0;
+	size_t width = alphabet.size();
+	auto dead = [&](const uint64_t *key) { return all_of(key, key + words, [](uint64_t w) { return !w; }); };
 
-	states.insert(tmp); statesVisited.insert(make_pair(stateUnified, tmp)); stateInitial = tmp;
-	statesToRun.push(stateUnified);
+	SubsetTable statesVisited(words); vector<uint64_t> successors(width * words);
+	CompiledDFA d {alphabet, 0, {}, statesVisited.intern(initial).first, {}};
 
-	while(!(statesToRun.empty()))
+	Index run = 0;
+	for (; run < statesVisited.size() && (threads < 2 || statesVisited.size() <= PARALLEL_STATES); ++run)
 	{
-		auto stateToRun = statesToRun.front();
+		d.m_FinalStates.push_back(expand(statesVisited.at(run), successors.data()));
+		for (size_t a = 0; a < width; ++a)
+		{ const uint64_t *key = successors.data() + a * words; d.m_Transitions.push_back(dead(key) ? NONE : statesVisited.intern(key).first); }
+	}
+
+	if (run == statesVisited.size()) { d.m_StatesCount = statesVisited.size(); return d; }
 
-		for (const auto& s : stateToRun) { if (n.m_FinalStates.count(s)) { statesFinal.insert(statesVisited.at(stateToRun)); break; } }
+	// Keys are interned in the shard picked by the top bits of their fingerprints, and named local * SHARDS + shard
+	const size_t SHARDS = 64;
+	struct Shard { mutex m_Mutex; SubsetTable m_States; explicit Shard(size_t words) : m_States(words) {} };
+	struct Worker { mutex m_Mutex; deque<Index> m_StatesToRun; vector<Index> m_Records; }; // Records: state, final, k targets
+	vector<unique_ptr<Shard>> shards; for (size_t s = 0; s < SHARDS; ++s) shards.push_back(make_unique<Shard>(words));
+	vector<unique_ptr<Worker>> workers; for (size_t t = 0; t < threads; ++t) workers.push_back(make_unique<Worker>());
+	atomic<size_t> statesPending(0); atomic<bool> failed(false); exception_ptr error; mutex errorMutex;
+	auto fail = [&](exception_ptr e) { lock_guard<mutex> lock(errorMutex); if (!error) error = e; failed = true; };
 
-		for (const auto& a : alphabet)
+	auto visit = [&](const uint64_t *key, Worker& worker)
+	{
+		uint64_t fingerprint = SubsetTable::get_fingerprint(key, words); size_t shard = fingerprint >> 58; pair<Index, bool> it;
+		{ lock_guard<mutex> lock(shards[shard]->m_Mutex); it = shards[shard]->m_States.intern(key, fingerprint); }
+		if (it.first >= NONE / SHARDS) throw length_error("");
+
+		Index state = it.first * SHARDS + shard;
+		if (it.second) { ++statesPending; lock_guard<mutex> lock(worker.m_Mutex); worker.m_StatesToRun.push_back(state); }
+		return state;
+	};
+	auto take = [&](size_t self, Index& state)
+	{
+		for (size_t t = 0; t < threads; ++t)
 		{
-			stateUnified.clear();
+			Worker& victim = *workers[(self + t) % threads]; lock_guard<mutex> lock(victim.m_Mutex);
+			if (victim.m_StatesToRun.empty()) continue;
+			if (t) { state = victim.m_StatesToRun.front(); victim.m_StatesToRun.pop_front(); }
+			else { state = victim.m_StatesToRun.back(); victim.m_StatesToRun.pop_back(); }
+			return true;
+		}
+		return false;
+	};
+	auto work = [&](size_t self)
+	{
+		try
+		{
+			Worker& worker = *workers[self]; vector<uint64_t> stateToRun(words), successors(width * words); Index state;
+			while (statesPending && !failed)
+			{
+				if (!(take(self, state))) { this_thread::yield(); continue; }
+				{ lock_guard<mutex> lock(shards[state % SHARDS]->m_Mutex); const uint64_t *key = shards[state % SHARDS]->m_States.at(state / SHARDS); copy(key, key + words, stateToRun.begin()); }
 
-			for (const auto& s : stateToRun)
-			{ pair<State, Symbol> transition = make_pair(s, a); stateUnified.insert(n.m_Transitions.at(transition).begin(),n.m_Transitions.at(transition).end()); }
+				worker.m_Records.push_back(state); worker.m_Records.push_back(expand(stateToRun.data(), successors.data()));
+				for (size_t a = 0; a < width; ++a) { const uint64_t *key = successors.data() + a * words; worker.m_Records.push_back(dead(key) ? NONE : visit(key, worker)); }
+				--statesPending;
+			}
+		}
+		catch (...) { fail(current_exception()); }
+	};
 
-			if (!(statesVisited.count(stateUnified)))
+	// Hand the states discovered so far over to the shards, the explored ones as records and the rest spread over the deques
+	vector<Index> statesNaming(statesVisited.size());
+	for (Index s = 0; s < statesVisited.size(); ++s)
+	{
+		uint64_t fingerprint = SubsetTable::get_fingerprint(statesVisited.at(s), words); size_t shard = fingerprint >> 58;
+		statesNaming[s] = shards[shard]->m_States.intern(statesVisited.at(s), fingerprint).first * SHARDS + shard;
+		if (s >= run) { workers[s % threads]->m_StatesToRun.push_back(statesNaming[s]); ++statesPending; }
+	}
+	for (Index s = 0; s < run; ++s)
+	{
+		vector<Index>& records = workers[0]->m_Records; records.push_back(statesNaming[s]); records.push_back(d.m_FinalStates[s]);
+		for (size_t a = 0; a < width; ++a) { Index target = d.m_Transitions[s * width + a]; records.push_back(target == NONE ? NONE : statesNaming[target]); }
+	}
+
+	Index stateInitial = statesNaming[d.m_InitialState];
+	vector<thread> workersRunning;
+	try { for (size_t t = 1; t < threads; ++t) workersRunning.emplace_back(work, t); }
+	catch (...) { fail(current_exception()); }
+	work(0); for (auto& w : workersRunning) w.join();
+	if (error) rethrow_exception(error);
+
+	vector<Index> offsets(SHARDS + 1, 0); for (size_t s = 0; s < SHARDS; ++s) offsets[s + 1] = offsets[s] + shards[s]->m_States.size();
+	auto naming = [&](Index state) { return state == NONE ? NONE : Index(offsets[state % SHARDS] + state / SHARDS); };
+
+	d = CompiledDFA {alphabet, offsets.back(), vector<Index>(offsets.back() * width), naming(stateInitial), vector<bool>(offsets.back())};
+	for (const auto& worker : workers)
+	{
+		const vector<Index>& records = worker->m_Records;
+		for (size_t r = 0; r < records.size(); r += width + 2)
+		{
+			Index state = naming(records[r]); d.m_FinalStates[state] = records[r + 1];
+			for (size_t a = 0; a < width; ++a) d.m_Transitions[state * width + a] = naming(records[r + 2 + a]);
+		}
+	}
+
+	return make_canonical(d);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Successor bitsets of a compiled NFA, for expanding bitset subsets of its states. Only the rows of the (q, a) with some
+// transition are stored, packed state by state in the order of their symbols
+struct SubsetSuccessors {
+	size_t m_Width; // Number of symbols
+	size_t m_Words; // Words per subset
+	vector<Index> m_Offsets; // Rows of q are m_Offsets[q] .. m_Offsets[q + 1], n + 1 entries
+	vector<Index> m_Symbols; // Row -> symbol index
+	vector<uint64_t> m_Successors; // Row -> successors as the bitset at row * m_Words
+	vector<uint64_t> m_FinalStates; // Final states as a subset
+	vector<uint64_t> m_InitialState; // Initial state as a subset
+
+	/**
+	 * @brief Precompute the successor bitsets of an NFA.
+	 *
+	 * @param n The compiled NFA.
+	 */
+	explicit SubsetSuccessors(const CompiledNFA& n)
+		: m_Width(n.m_Alphabet.size()), m_Words((n.m_StatesCount + 63) / 64), m_Offsets(1, 0), m_FinalStates(m_Words, 0), m_InitialState(m_Words, 0)
+	{
+		for (Index s = 0; s < n.m_StatesCount; ++s)
+		{
+			if (n.m_FinalStates[s]) m_FinalStates[s / 64] |= 1ull << (s % 64);
+			for (size_t a = 0, c = s * m_Width; a < m_Width; ++a, ++c)
 			{
-				statesVisited.insert(make_pair(stateUnified, ++tmp));
-				states.insert(statesVisited.at(stateUnified));
-				statesToRun.push(stateUnified);
-			}
+				if (n.m_Offsets[c] == n.m_Offsets[c + 1]) continue;
 
-			pair<State, Symbol> transition = make_pair(statesVisited.at(stateToRun), a);
-			transitions[transition] = statesVisited.at(stateUnified);
+				m_Symbols.push_back(a); m_Successors.resize(m_Successors.size() + m_Words, 0);
+				uint64_t *row = m_Successors.data() + m_Successors.size() - m_Words;
+				for (Index i = n.m_Offsets[c]; i < n.m_Offsets[c + 1]; ++i) row[n.m_Targets[i] / 64] |= 1ull << (n.m_Targets[i] % 64);
+			}
+			m_Offsets.push_back(m_Symbols.size());
 		}
+		m_InitialState[n.m_InitialState / 64] |= 1ull << (n.m_InitialState % 64);
+	}
 
-		statesToRun.pop();
+	/**
+	 * @brief Compute the successors of a subset on all symbols, one after another, as the word-wise OR of the rows of its states.
+	 *
+	 * @param subset The subset.
+	 * @param successors Receives k subsets.
+	 * @return bool True if the subset contains a final state.
+	 */
+	bool expand(const uint64_t *subset, uint64_t *successors) const
+	{
+		bool subsetFinal = false; fill(successors, successors + m_Width * m_Words, 0);
+		for (size_t w = 0; w < m_Words; ++w)
+		{
+			if (subset[w] & m_FinalStates[w]) subsetFinal = true;
+			for (uint64_t bits = subset[w]; bits; bits &= bits - 1)
+			{
+				Index state = w * 64 + __builtin_ctzll(bits);
+				for (Index r = m_Offsets[state]; r < m_Offsets[state + 1]; ++r)
+				{
+					const uint64_t *row = m_Successors.data() + r * m_Words; uint64_t *target = successors + m_Symbols[r] * m_Words;
+					for (size_t i = 0; i < m_Words; ++i) target[i] |= row[i];
+				}
+			}
+		}
+		return subsetFinal;
 	}
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Converts an NFA to a DFA.
+ *
+ * Subsets are bitsets. The successors of a subset on all symbols are the word-wise OR of precomputed successor bitsets
+ * of its states, and subsets are interned in a SubsetTable. The empty subset is left as an undefined transition.
+ *
+ * @param n The input compiled NFA.
+ * @param threads The number of threads to use.
+ * @return CompiledDFA The resulting DFA.
+ */
+CompiledDFA make_determined(const CompiledNFA& n, size_t threads = 1)
+{
+	SubsetSuccessors successors(n);
+	auto expand = [&](const uint64_t *stateToRun, uint64_t *stateUnified) { return successors.expand(stateToRun, stateUnified); };
 
-	return DFA {states, alphabet, transitions, stateInitial, statesFinal};
+	return make_explored(n.m_Alphabet, successors.m_Words, successors.m_InitialState.data(), expand, threads);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief Filters the reachable states in a DFA.
+ * @brief Keeps only the marked states of a DFA, renumbering them in order and dropping transitions into removed states.
+ *
+ * If the initial state is not kept, the result is the DFA of the empty language: the initial state without transitions.
  *
  * @param d The input DFA.
- * @return DFA The resulting DFA with only reachable states.
+ * @param statesKept The flag per state whether to keep it.
+ * @return CompiledDFA The resulting DFA.
  */
-DFA make_reachable(const DFA& d)
+CompiledDFA make_restricted(const CompiledDFA& d, const vector<bool>& statesKept)
 {
-	queue<State> statesToRun; statesToRun.push(d.m_InitialState);
-	set<State> statesReachable = {d.m_InitialState};
+	size_t width = d.m_Alphabet.size();
+	if (!(statesKept[d.m_InitialState])) return CompiledDFA {d.m_Alphabet, 1, vector<Index>(width, NONE), 0, {false}};
 
-	while (!(statesToRun.empty()))
-	{
-		for (const auto& a : d.m_Alphabet)
-		{ auto transition = make_pair(statesToRun.front(), a);
-			if (!(statesReachable.count(d.m_Transitions.at(transition))))
-			{ statesReachable.insert(d.m_Transitions.at(transition)); statesToRun.push(d.m_Transitions.at(transition)); } }
+	vector<Index> statesNaming(d.m_StatesCount, NONE); Index tmp = 0;
+	for (Index s = 0; s < d.m_StatesCount; ++s) if (statesKept[s]) statesNaming[s] = tmp++;
+	if (tmp == d.m_StatesCount) return d;
 
-		statesToRun.pop();
+	CompiledDFA dRestricted {d.m_Alphabet, tmp, {}, statesNaming[d.m_InitialState], {}};
+	for (Index s = 0; s < d.m_StatesCount; ++s)
+	{
+		if (!(statesKept[s])) continue;
+		dRestricted.m_FinalStates.push_back(d.m_FinalStates[s]);
+		for (size_t a = 0; a < width; ++a) { Index target = d.m_Transitions[s * width + a]; dRestricted.m_Transitions.push_back(target == NONE ? NONE : statesNaming[target]); }
 	}
 
-	set<State> statesUnreachable; set_difference(d.m_States.begin(), d.m_States.end(), statesReachable.begin(), statesReachable.end(),
-												 inserter(statesUnreachable, statesUnreachable.end()));
+	return dRestricted;
+}
 
-	if (statesUnreachable.empty()) return d;
+// ---------------------------------------------------------------------------------------------------------------------
 
-	set<State> states = statesReachable, statesFinal; map<pair<State, Symbol>, State> transitions = d.m_Transitions; set<Symbol> alphabet = d.m_Alphabet;
-	State fail = 9999;
-	set_difference(d.m_FinalStates.begin(), d.m_FinalStates.end(), statesUnreachable.begin(), statesUnreachable.end(),
-	               inserter(statesFinal, statesFinal.end()));
+/**
+ * @brief Finds the states of a DFA reachable from its initial state.
+ *
+ * @param d The input DFA.
+ * @return vector<bool> The flag per state whether it is reachable.
+ */
+vector<bool> get_reachable(const CompiledDFA& d)
+{
+	size_t width = d.m_Alphabet.size();
+	vector<Index> statesToRun = {d.m_InitialState}; vector<bool> statesReachable(d.m_StatesCount, false); statesReachable[d.m_InitialState] = true;
 
-	for (auto& t : transitions) {  if (statesUnreachable.count(t.second)) transitions[t.first] = fail; }
-	for (const auto& a : alphabet) { for (const auto& u : statesUnreachable) { pair<State, Symbol> transition = make_pair(u, a); transitions.erase(transition); } }
+	for (Index run = 0; run < statesToRun.size(); ++run)
+	{
+		for (size_t a = 0; a < width; ++a)
+		{
+			Index target = d.m_Transitions[statesToRun[run] * width + a];
+			if (target != NONE && !(statesReachable[target])) { statesReachable[target] = true; statesToRun.push_back(target); }
+		}
+	}
 
-	return DFA {states, alphabet, transitions, d.m_InitialState, statesFinal};
+	return statesReachable;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**
- * @brief Filters the useful states in a DFA.
+ * @brief Finds the states of a DFA from which a final state can be reached, by one backward search over a predecessor index.
  *
  * @param d The input DFA.
- * @return DFA The resulting DFA with only useful states.
+ * @param statesConsidered The flag per state whether it takes part in the search, other states are neither entered nor left.
+ * @return vector<bool> The flag per state whether it is considered and useful.
  */
-DFA make_useful(const DFA& d)
+vector<bool> get_useful(const CompiledDFA& d, const vector<bool>& statesConsidered)
 {
-	queue<State> statesToRun; for (const auto& s : d.m_FinalStates) statesToRun.push(s);
-	set<State> statesUseful = d.m_FinalStates;
+	size_t width = d.m_Alphabet.size();
 
-	while (!(statesToRun.empty()))
+	// Predecessors of q are statesInverse[offsetsInverse[q] .. offsetsInverse[q + 1]), one entry per transition
+	vector<Index> offsetsInverse(d.m_StatesCount + 1, 0), statesInverse;
+	for (Index s = 0; s < d.m_StatesCount; ++s)
+	{
+		if (!(statesConsidered[s])) continue;
+		for (size_t a = 0; a < width; ++a) { Index target = d.m_Transitions[s * width + a]; if (target != NONE) ++offsetsInverse[target + 1]; }
+	}
+	partial_sum(offsetsInverse.begin(), offsetsInverse.end(), offsetsInverse.begin()); statesInverse.resize(offsetsInverse.back());
 	{
-		for (const auto& t : d.m_Transitions)
-		{ if (t.second == statesToRun.front()) { if (!(statesUseful.count(t.first.first))) { statesUseful.insert(t.first.first); statesToRun.push(t.first.first); } } }
+		vector<Index> offsetsFill(offsetsInverse.begin(), offsetsInverse.end() - 1);
+		for (Index s = 0; s < d.m_StatesCount; ++s)
+		{
+			if (!(statesConsidered[s])) continue;
+			for (size_t a = 0; a < width; ++a) { Index target = d.m_Transitions[s * width + a]; if (target != NONE) statesInverse[offsetsFill[target]++] = s; }
+		}
+	}
+
+	vector<Index> statesToRun; vector<bool> statesUseful(d.m_StatesCount, false);
+	for (Index s = 0; s < d.m_StatesCount; ++s) if (statesConsidered[s] && d.m_FinalStates[s]) { statesUseful[s] = true; statesToRun.push_back(s); }
+
+	for (Index run = 0; run < statesToRun.size(); ++run)
+	{
+		for (Index i = offsetsInverse[statesToRun[run]]; i < offsetsInverse[statesToRun[run] + 1]; ++i)
+		{ Index source = statesInverse[i]; if (!(statesUseful[source])) { statesUseful[source] = true; statesToRun.push_back(source); } }
+	}
+
+	return statesUseful;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Filters the states of a DFA that are both reachable and useful, in a single restriction.
+ *
+ * A DFA of the empty language is reduced to the initial state without transitions.
+ *
+ * @param d The input DFA.
+ * @return CompiledDFA The resulting trimmed DFA.
+ */
+CompiledDFA make_trimmed(const CompiledDFA& d) { return make_restricted(d, get_useful(d, get_reachable(d))); }
 
-		statesToRun.pop();
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Refinable partition of the states 0..n-1, each block is a contiguous range of m_Elements with its marked states in front
+struct Partition {
+	vector<Index> m_Elements; // States ordered by block
+	vector<Index> m_Location; // State -> position in m_Elements
+	vector<Index> m_Block; // State -> block
+	vector<Index> m_First, m_Marked, m_End; // Block -> range [m_First, m_End) of m_Elements, marked states in [m_First, m_Marked)
+
+	/**
+	 * @brief Creates a partition of the states into the final and the non-final ones.
+	 *
+	 * @param finals The final flag per state.
+	 */
+	explicit Partition(const vector<bool>& finals) : m_Elements(finals.size()), m_Location(finals.size()), m_Block(finals.size())
+	{
+		Index front = 0, back = finals.size();
+		for (Index s = 0; s < finals.size(); ++s) { m_Location[s] = finals[s] ? front++ : --back; m_Elements[m_Location[s]] = s; }
+		if (front) add_block(0, front);
+		if (back < finals.size()) add_block(back, finals.size());
 	}
 
-	set<State> statesUnuseful; set_difference(d.m_States.begin(), d.m_States.end(), statesUseful.begin(), statesUseful.end(),
-	                                             inserter(statesUnuseful, statesUnuseful.end()));
+	/**
+	 * @brief Get the number of blocks.
+	 *
+	 * @return Index The number of blocks.
+	 */
+	Index size() const { return m_First.size(); }
+
+	/**
+	 * @brief Mark a state, moving it to the marked front of its block.
+	 *
+	 * @param state The state.
+	 * @return bool True if the state is the first marked state of its block.
+	 */
+	bool mark(Index state)
+	{
+		Index block = m_Block[state], position = m_Location[state], marked = m_Marked[block]++;
+		if (position < marked) { --m_Marked[block]; return false; }
+
+		swap(m_Elements[position], m_Elements[marked]); m_Location[m_Elements[position]] = position; m_Location[state] = marked;
 
-	if (statesUnuseful.empty()) return d;
+		return marked == m_First[block];
+	}
 
-	set<State> states = statesUseful, statesFinal = d.m_FinalStates; map<pair<State, Symbol>, State> transitions = d.m_Transitions; set<Symbol> alphabet = d.m_Alphabet;
-	State fail = 9999;
+	/**
+	 * @brief Split the marked states of a block off into a new block, unless all of its states are marked.
+	 *
+	 * @param block The block.
+	 * @return Index The new block, or NONE if the block was not split.
+	 */
+	Index split(Index block)
+	{
+		Index marked = m_Marked[block]; m_Marked[block] = m_First[block];
+		if (marked == m_End[block]) return NONE;
 
-	for (auto& t : transitions) { if (statesUnuseful.count(t.second)) transitions[t.first] = fail; }
-	for (const auto& a : alphabet) { for (const auto& u : statesUnuseful) { pair<State, Symbol> transition = make_pair(u, a); transitions.erase(transition); } }
+		Index blockNew = add_block(m_First[block], marked); m_First[block] = m_Marked[block] = marked;
 
-	return DFA {states, alphabet, transitions, d.m_InitialState, statesFinal};
-}
+		return blockNew;
+	}
+
+  private:
+	/**
+	 * @brief Turn a range of m_Elements into a new block.
+	 *
+	 * @param first The first position of the range.
+	 * @param end The position past the range.
+	 * @return Index The new block.
+	 */
+	Index add_block(Index first, Index end)
+	{
+		Index block = m_First.size(); m_First.push_back(first); m_Marked.push_back(first); m_End.push_back(end);
+		for (Index i = first; i < end; ++i) m_Block[m_Elements[i]] = block;
+
+		return block;
+	}
+};
 
 // ---------------------------------------------------------------------------------------------------------------------
 
 /**
  * @brief Minimizes a DFA.
  *
+ * Uses Hopcroft's partition refinement over inverse transitions, in O(n · k · log n). Undefined transitions are treated
+ * as transitions into an extra dead state, whose block is dropped from the result.
+ *
  * @param d The input DFA.
- * @return DFA The minimized DFA.
+ * @return CompiledDFA The minimized DFA, without the dead state.
 */
-DFA make_minimized(const DFA& d)
+CompiledDFA make_minimized(const CompiledDFA& d)
 {
-	DFA dReachable = make_reachable(d); DFA dUseful = make_useful(dReachable);
-
-	if (dUseful.m_Transitions.empty() || dUseful.m_FinalStates.empty()) return DFA {{dUseful.m_InitialState}, dUseful.m_Alphabet, dUseful.m_Transitions, dUseful.m_InitialState, dUseful.m_FinalStates};
+	CompiledDFA dUseful = make_trimmed(d);
+	size_t width = dUseful.m_Alphabet.size(); Index fail = dUseful.m_StatesCount, statesCount = fail + 1;
+	auto target = [&](Index s, size_t a) { Index t = s == fail ? NONE : dUseful.m_Transitions[s * width + a]; return t == NONE ? fail : t; };
+
+	// Predecessors of (q, a) are statesInverse[offsetsInverse[q * k + a] .. offsetsInverse[q * k + a + 1])
+	vector<Index> offsetsInverse(statesCount * width + 1, 0), statesInverse(statesCount * width);
+	for (Index s = 0; s < statesCount; ++s) for (size_t a = 0; a < width; ++a) ++offsetsInverse[target(s, a) * width + a + 1];
+	partial_sum(offsetsInverse.begin(), offsetsInverse.end(), offsetsInverse.begin());
+	{
+		vector<Index> offsetsFill(offsetsInverse.begin(), offsetsInverse.end() - 1);
+		for (Index s = 0; s < statesCount; ++s) for (size_t a = 0; a < width; ++a) statesInverse[offsetsFill[target(s, a) * width + a]++] = s;
+	}
 
-	map<pair<State, Symbol>, State> transitions = dUseful.m_Transitions;
-	set<Symbol> alphabet = dUseful.m_Alphabet; Symbol symbolLast = *(--alphabet.end()); State fail = 9999;
-	map<State, State> statesNaming; statesNaming.insert(make_pair(fail, fail));
-	for (const auto& s : dUseful.m_States) { if (dUseful.m_FinalStates.count(s)) statesNaming.insert(make_pair(s, 0)); else statesNaming.insert(make_pair(s, 1)); }
-	map<State, vector<pair<pair<State, Symbol>, State>>> statesMinimized;
-	for (const auto& t : transitions) statesMinimized[statesNaming.at(t.first.first)].push_back(make_pair(t.first, t.second));
-	queue<map<State, vector<pair<pair<State, Symbol>, State>>>> groupsToRun; groupsToRun.push(statesMinimized);
-	map<vector<State>, set<State>> statesOfGroupToChangeTmp;
+	vector<bool> statesFinal = dUseful.m_FinalStates; statesFinal.push_back(false);
+	Partition partition(statesFinal);
+	vector<Index> groupsToRun, splitter, groupsTouched; vector<bool> groupsWaiting(partition.size(), false);
+	if (partition.size() == 2) { Index smaller = partition.m_End[0] - partition.m_First[0] <= partition.m_End[1] - partition.m_First[1] ? 0 : 1; groupsToRun.push_back(smaller); groupsWaiting[smaller] = true; }
 
 	while (!(groupsToRun.empty()))
 	{
-		auto groupToRun = groupsToRun.front(); groupsToRun.pop();
-		map<vector<State>, set<State>> statesOfGroupToChange;
+		Index group = groupsToRun.back(); groupsToRun.pop_back(); groupsWaiting[group] = false;
+		splitter.assign(partition.m_Elements.begin() + partition.m_First[group], partition.m_Elements.begin() + partition.m_End[group]);
 
-		for (const auto& g : groupToRun)
+		for (size_t a = 0; a < width; ++a)
 		{
-			set<pair<pair<State, Symbol>, State>> transitionMinimized;
+			for (const auto& t : splitter)
+				for (Index i = offsetsInverse[t * width + a]; i < offsetsInverse[t * width + a + 1]; ++i)
+					if (partition.mark(statesInverse[i])) groupsTouched.push_back(partition.m_Block[statesInverse[i]]);
 
-			for (const auto& t : g.second)
+			for (const auto& g : groupsTouched)
 			{
-				transitionMinimized.insert(make_pair(make_pair(statesNaming.at(t.first.first), t.first.second), statesNaming.at(t.second)));
+				Index groupNew = partition.split(g); if (groupNew == NONE) continue;
+				groupsWaiting.push_back(false);
 
-				if (t.first.second == symbolLast)
-				{
-					vector<State> group = { statesNaming.at(t.first.first) }; for (const auto& s : transitionMinimized) group.push_back(s.second);
-					statesOfGroupToChange[group].insert(t.first.first); transitionMinimized.clear();
-				}
+				// Hopcroft's rule: a waiting group is replaced by both halves, otherwise the smaller half is enough
+				Index smaller = partition.m_End[groupNew] - partition.m_First[groupNew] <= partition.m_End[g] - partition.m_First[g] ? groupNew : g;
+				if (groupsWaiting[g]) smaller = groupNew;
+				if (!(groupsWaiting[smaller])) { groupsToRun.push_back(smaller); groupsWaiting[smaller] = true; }
 			}
+			groupsTouched.clear();
 		}
+	}
 
-		if (statesOfGroupToChange.size() != statesOfGroupToChangeTmp.size())
-		{
-			statesOfGroupToChangeTmp = statesOfGroupToChange; State tmp = 0;
-			for (const auto& g : statesOfGroupToChange) { for (const auto& s : g.second) { statesNaming.at(s) = tmp;} ++tmp; }
+	Index groupFail = partition.m_Block[fail];
+	if (partition.m_Block[dUseful.m_InitialState] == groupFail) return CompiledDFA {dUseful.m_Alphabet, 1, vector<Index>(width, NONE), 0, {false}};
 
-			statesMinimized.clear(); for (const auto& t : transitions) statesMinimized[statesNaming.at(t.first.first)].push_back(make_pair(t.first, t.second));
-			groupsToRun.push(statesMinimized);
-		}
+	vector<Index> groupsNaming(partition.size(), NONE); Index groupsCount = 0;
+	for (Index g = 0; g < partition.size(); ++g) if (g != groupFail) groupsNaming[g] = groupsCount++;
+	auto naming = [&](Index s) { return groupsNaming[partition.m_Block[s]]; };
+
+	CompiledDFA dMinimized {dUseful.m_Alphabet, groupsCount, vector<Index>(groupsCount * width), naming(dUseful.m_InitialState), vector<bool>(groupsCount)};
+	for (Index s = 0; s < fail; ++s)
+	{
+		dMinimized.m_FinalStates[naming(s)] = dUseful.m_FinalStates[s];
+		for (size_t a = 0; a < width; ++a) dMinimized.m_Transitions[naming(s) * width + a] = naming(target(s, a));
 	}
 
-	State stateInitialMinimized = 0;
-	set<State> states, statesFinalMinimized; for (const auto& s : statesMinimized) states.insert(s.first);
-	map<pair<State, Symbol>, State> transitionsMinimized;
-	for (const auto& t : transitions)
+	return dMinimized;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Creates the synchronous product of two DFAs, exploring only the pairs reachable from the initial pair.
+ *
+ * An undefined transition of an operand is a transition into its dead state. Pairs that are dead for the given type
+ * (either operand dead for intersection, both for unification) are not created at all.
+ *
+ * @param a The first DFA.
+ * @param b The second DFA, over the same alphabet.
+ * @param type True for unification, false for intersection.
+ * @param threads The number of threads to use.
+ * @return CompiledDFA The resulting DFA.
+ */
+CompiledDFA make_product(const CompiledDFA& a, const CompiledDFA& b, bool type, size_t threads = 1)
+{
+	size_t width = a.m_Alphabet.size();
+
+	// The key of a pair holds both states plus one, so that the dead state of an operand is 0 and the dead pair is the zero key
+	auto key = [](Index s1, Index s2) { return (uint64_t(Index(s1 + 1)) << 32) | Index(s2 + 1); };
+	auto expand = [&](const uint64_t *stateToRun, uint64_t *stateUnified)
 	{
-		if (t.second != fail) transitionsMinimized.insert(make_pair(make_pair(statesNaming.at(t.first.first), t.first.second), statesNaming.at(t.second)));
-		if (t.first.first == dUseful.m_InitialState) stateInitialMinimized = statesNaming.at(t.first.first);
-		if (dUseful.m_FinalStates.count(t.first.first)) statesFinalMinimized.insert(statesNaming.at(t.first.first));
+		Index s1 = Index(*stateToRun >> 32) - 1, s2 = Index(*stateToRun) - 1;
+		for (size_t c = 0; c < width; ++c)
+		{
+			Index t1 = s1 == NONE ? NONE : a.m_Transitions[s1 * width + c], t2 = s2 == NONE ? NONE : b.m_Transitions[s2 * width + c];
+			stateUnified[c] = (type ? (t1 == NONE && t2 == NONE) : (t1 == NONE || t2 == NONE)) ? 0 : key(t1, t2);
+		}
+
+		bool final1 = s1 != NONE && a.m_FinalStates[s1], final2 = s2 != NONE && b.m_FinalStates[s2];
+		return type ? (final1 || final2) : (final1 && final2);
+	};
+
+	uint64_t stateInitial = key(a.m_InitialState, b.m_InitialState);
+
+	return make_explored(a.m_Alphabet, 1, &stateInitial, expand, threads);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Chooses how to combine two NFAs.
+ *
+ * Determinizing the parallel run explores subsets of pairs of states, which can blow up far worse than determinizing
+ * each operand, so the operands are determinized first unless both are deterministic already or the run is tiny.
+ *
+ * @param a The first NFA.
+ * @param b The second NFA.
+ * @return Pipeline The pipeline to use.
+ */
+Pipeline get_pipeline(const CompiledNFA& a, const CompiledNFA& b)
+{
+	auto deterministic = [](const CompiledNFA& n)
+	{
+		for (size_t c = 0; c + 1 < n.m_Offsets.size(); ++c) if (n.m_Offsets[c + 1] - n.m_Offsets[c] > 1) return false;
+		return true;
+	};
+
+	if (uint64_t(a.m_StatesCount) * b.m_StatesCount <= 64 || (deterministic(a) && deterministic(b))) return Pipeline::PRODUCT_FIRST;
+
+	return Pipeline::DETERMINIZE_FIRST;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Combines two NFAs into a DFA for their unification or intersection.
+ *
+ * @param a The first NFA.
+ * @param b The second NFA.
+ * @param type True for unification, false for intersection.
+ * @param pipeline The pipeline to use, or AUTOMATIC to choose one; receives the pipeline taken.
+ * @return CompiledDFA The resulting DFA, not minimized.
+ */
+CompiledDFA make_combined(const NFA& a, const NFA& b, bool type, Pipeline& pipeline)
+{
+	set<Symbol> alphabet = a.m_Alphabet; alphabet.insert(b.m_Alphabet.begin(), b.m_Alphabet.end());
+	CompiledNFA aCompiled = compile(a, alphabet), bCompiled = compile(b, alphabet);
+	if (pipeline == Pipeline::AUTOMATIC) pipeline = get_pipeline(aCompiled, bCompiled);
+
+	size_t threads = thread::hardware_concurrency();
+
+	if (pipeline == Pipeline::DETERMINIZE_FIRST)
+	{
+		CompiledDFA aMinimized = make_minimized(make_determined(aCompiled, threads));
+		CompiledDFA bMinimized = make_minimized(make_determined(bCompiled, threads));
+		return make_product(aMinimized, bMinimized, type, threads);
 	}
 
-	return DFA {states, alphabet, transitionsMinimized, stateInitialMinimized, statesFinalMinimized};
+	CompiledNFA run = make_parallel_run(aCompiled, bCompiled, type);
+
+	return make_determined(run, threads);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -333,15 +916,19 @@ DFA make_minimized(const DFA& d)
  *
  * @param a The first NFA.
  * @param b The second NFA.
+ * @param pipeline The pipeline to use, or AUTOMATIC to choose one; receives the pipeline taken.
  * @return DFA The resulting minimal DFA for the union.
 */
-DFA unify(const NFA& a, const NFA& b)
-{
-	NFA aComplete = make_complete(a, b.m_Alphabet), bComplete = make_complete(b, a.m_Alphabet);
-	NFA u = make_parallel_run(aComplete, bComplete, true); DFA uDetermined = make_determined(u); DFA uMinimized = make_minimized(uDetermined);
+DFA unify(const NFA& a, const NFA& b, Pipeline& pipeline) { return decompile(make_minimized(make_combined(a, b, true, pipeline))); }
 
-	return uMinimized;
-}
+/**
+ * @brief Computes the minimal DFA that accepts the union of languages specified by two NFAs.
+ *
+ * @param a The first NFA.
+ * @param b The second NFA.
+ * @return DFA The resulting minimal DFA for the union.
+*/
+DFA unify(const NFA& a, const NFA& b) { Pipeline pipeline = Pipeline::AUTOMATIC; return unify(a, b, pipeline); }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
@@ -350,18 +937,384 @@ DFA unify(const NFA& a, const NFA& b)
  *
  * @param a The first NFA.
  * @param b The second NFA.
+ * @param pipeline The pipeline to use, or AUTOMATIC to choose one; receives the pipeline taken.
  * @return DFA The resulting minimal DFA for the intersection.
 */
-DFA intersect(const NFA& a, const NFA& b)
+DFA intersect(const NFA& a, const NFA& b, Pipeline& pipeline) { return decompile(make_minimized(make_combined(a, b, false, pipeline))); }
+
+/**
+ * @brief Computes the minimal DFA that accepts the intersection of languages specified by two NFAs.
+ *
+ * @param a The first NFA.
+ * @param b The second NFA.
+ * @return DFA The resulting minimal DFA for the intersection.
+*/
+DFA intersect(const NFA& a, const NFA& b) { Pipeline pipeline = Pipeline::AUTOMATIC; return intersect(a, b, pipeline); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Run tasks 0..n-1 on a number of threads, each thread taking the next task until none is left.
+ *
+ * The first exception thrown by a task stops the threads from taking further tasks and is rethrown once they are joined.
+ *
+ * @param tasks The number of tasks.
+ * @param task The task, called with its number.
+ * @param threads The number of threads to use, the calling one included.
+ */
+void run_parallel(size_t tasks, const function<void(size_t)>& task, size_t threads)
+{
+	atomic<size_t> taskNext(0); exception_ptr error; mutex errorMutex;
+	auto fail = [&](exception_ptr e) { lock_guard<mutex> lock(errorMutex); if (!error) error = e; taskNext = tasks; };
+	auto worker = [&]()
+	{
+		try { for (size_t i = taskNext++; i < tasks; i = taskNext++) task(i); }
+		catch (...) { fail(current_exception()); }
+	};
+
+	vector<thread> workers;
+	try { for (size_t t = 1; t < min(threads, tasks); ++t) workers.emplace_back(worker); }
+	catch (...) { fail(current_exception()); }
+	worker(); for (auto& w : workers) w.join();
+	if (error) rethrow_exception(error);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Combines NFAs into a minimal DFA for their unification or intersection.
+ *
+ * Each operand is determinized and minimized, then the DFAs are merged pairwise in a balanced tree, the smallest ones
+ * first, minimizing after every merge. The merges of one level are independent and run in parallel. Once an
+ * intermediate DFA absorbs the result (the universal language for unification, the empty one for intersection), the
+ * rest is skipped.
+ *
+ * @param automata The NFAs, at least one.
+ * @param type True for unification, false for intersection.
+ * @param threads The number of threads to use.
+ * @return CompiledDFA The resulting minimal DFA.
+ */
+CompiledDFA make_combined(const vector<NFA>& automata, bool type, size_t threads)
 {
-	NFA aComplete = make_complete(a, b.m_Alphabet), bComplete = make_complete(b, a.m_Alphabet);
-	NFA i = make_parallel_run(aComplete, bComplete, false); DFA iDetermined = make_determined(i); DFA iMinimized = make_minimized(iDetermined);
+	if (automata.empty()) throw invalid_argument("");
+
+	set<Symbol> alphabet; for (const auto& n : automata) alphabet.insert(n.m_Alphabet.begin(), n.m_Alphabet.end());
+	size_t width = alphabet.size(); atomic<bool> absorbed(false);
+	auto absorbing = [&](const CompiledDFA& d)
+	{
+		if (!type) return find(d.m_FinalStates.begin(), d.m_FinalStates.end(), true) == d.m_FinalStates.end();
+		return d.m_StatesCount == 1 && d.m_FinalStates[0] && find(d.m_Transitions.begin(), d.m_Transitions.end(), NONE) == d.m_Transitions.end();
+	};
+
+	vector<CompiledDFA> level(automata.size());
+	run_parallel(level.size(), [&](size_t i)
+	{
+		if (absorbed) return;
+		CompiledNFA n = compile(automata[i], alphabet);
+		level[i] = make_minimized(make_determined(n, threads / level.size()));
+		if (absorbing(level[i])) absorbed = true;
+	}, threads);
+
+	while (level.size() > 1 && !absorbed)
+	{
+		sort(level.begin(), level.end(), [](const CompiledDFA& a, const CompiledDFA& b) { return a.m_StatesCount < b.m_StatesCount; });
+
+		vector<CompiledDFA> levelNext((level.size() + 1) / 2);
+		run_parallel(level.size() / 2, [&](size_t i)
+		{
+			if (absorbed) return;
+			const CompiledDFA &a = level[2 * i], &b = level[2 * i + 1];
+			levelNext[i] = make_minimized(make_product(a, b, type, threads / (level.size() / 2)));
+			if (absorbing(levelNext[i])) absorbed = true;
+		}, threads);
+		if (level.size() % 2) levelNext.back() = move(level.back());
+
+		level.swap(levelNext);
+	}
+
+	if (absorbed) return CompiledDFA {vector<Symbol>(alphabet.begin(), alphabet.end()), 1, vector<Index>(width, type ? 0 : NONE), 0, {type}};
 
-	return iMinimized;
+	return level.front();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+/**
+ * @brief Computes the minimal DFA that accepts the union of languages specified by NFAs.
+ *
+ * @param automata The NFAs, at least one.
+ * @param threads The number of threads to use.
+ * @return DFA The resulting minimal DFA for the union.
+*/
+DFA unify(const vector<NFA>& automata, size_t threads = thread::hardware_concurrency()) { return decompile(make_combined(automata, true, max<size_t>(threads, 1))); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Computes the minimal DFA that accepts the intersection of languages specified by NFAs.
+ *
+ * @param automata The NFAs, at least one.
+ * @param threads The number of threads to use.
+ * @return DFA The resulting minimal DFA for the intersection.
+*/
+DFA intersect(const vector<NFA>& automata, size_t threads = thread::hardware_concurrency()) { return decompile(make_combined(automata, false, max<size_t>(threads, 1))); }
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Target lists of a compiled NFA, for stepping bitset subsets of its states one symbol at a time without any bitset rows
+struct SubsetTargets {
+	CompiledNFA m_Automaton; // The NFA
+	size_t m_Width; // Number of symbols
+	size_t m_Words; // Words per subset
+	vector<uint64_t> m_InitialState; // Initial state as a subset
+
+	/**
+	 * @brief Keep the target lists of an NFA.
+	 *
+	 * @param n The compiled NFA.
+	 */
+	explicit SubsetTargets(CompiledNFA n)
+		: m_Automaton(move(n)), m_Width(m_Automaton.m_Alphabet.size()), m_Words((m_Automaton.m_StatesCount + 63) / 64), m_InitialState(m_Words, 0)
+	{ m_InitialState[m_Automaton.m_InitialState / 64] |= 1ull << (m_Automaton.m_InitialState % 64); }
+
+	/**
+	 * @brief Get the memory held, in bytes.
+	 *
+	 * @return size_t The size of the target lists, final flags and initial subset.
+	 */
+	size_t get_memory() const
+	{
+		return (m_Automaton.m_Offsets.size() + m_Automaton.m_Targets.size()) * sizeof(Index) + (m_Automaton.m_StatesCount + 7) / 8
+			+ m_InitialState.size() * sizeof(uint64_t);
+	}
+
+	/**
+	 * @brief Compute the successors of a subset on one symbol, as the union of the target lists of its states.
+	 *
+	 * @param subset The subset.
+	 * @param symbol The symbol index.
+	 * @param successors Receives the subset of successors.
+	 */
+	void step(const uint64_t *subset, size_t symbol, uint64_t *successors) const
+	{
+		fill(successors, successors + m_Words, 0);
+		for (size_t w = 0; w < m_Words; ++w)
+		{
+			for (uint64_t bits = subset[w]; bits; bits &= bits - 1)
+			{
+				size_t c = (w * 64 + __builtin_ctzll(bits)) * m_Width + symbol;
+				for (Index i = m_Automaton.m_Offsets[c]; i < m_Automaton.m_Offsets[c + 1]; ++i)
+					successors[m_Automaton.m_Targets[i] / 64] |= 1ull << (m_Automaton.m_Targets[i] % 64);
+			}
+		}
+	}
+
+	/**
+	 * @brief Check whether a subset contains a final state.
+	 *
+	 * @param subset The subset.
+	 * @return bool True if it does.
+	 */
+	bool is_final(const uint64_t *subset) const
+	{
+		for (size_t w = 0; w < m_Words; ++w)
+			for (uint64_t bits = subset[w]; bits; bits &= bits - 1) if (m_Automaton.m_FinalStates[w * 64 + __builtin_ctzll(bits)]) return true;
+		return false;
+	}
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ * @brief Matcher of words against the unification or intersection of two NFAs (or against one NFA), which determinizes
+ * lazily while scanning.
+ *
+ * A state is the pair of subsets of states of both NFAs, computed the first time a transition leads to it from the target
+ * lists of its states. States and their transitions are cached within a memory budget, which also covers the target lists,
+ * and the whole cache is flushed when it is full, so automata whose DFA would be huge can be matched without constructing
+ * it. A matcher is not safe to share between threads.
+ */
+class LazyMatcher {
+  public:
+	/**
+	 * @brief Construct a new LazyMatcher object for the unification or intersection of two NFAs.
+	 *
+	 * @param a The first NFA.
+	 * @param b The second NFA.
+	 * @param type True for unification, false for intersection.
+	 * @param memory The memory budget of the operands and the cache in bytes.
+	 */
+	LazyMatcher(const NFA& a, const NFA& b, bool type, size_t memory = 1 << 20)
+		: LazyMatcher(a, b, type, memory, get_alphabet(a, b)) {}
+
+	/**
+	 * @brief Construct a new LazyMatcher object for one NFA.
+	 *
+	 * @param a The NFA.
+	 * @param memory The memory budget of the operands and the cache in bytes.
+	 */
+	explicit LazyMatcher(const NFA& a, size_t memory = 1 << 20) : LazyMatcher(a, NFA {{0}, a.m_Alphabet, {}, 0, {}}, true, memory) {}
+
+	/**
+	 * @brief Check whether a word is accepted.
+	 *
+	 * @param first The first symbol of the word.
+	 * @param last The end of the word.
+	 * @return bool True if the word is accepted.
+	 */
+	template <typename Iterator>
+	bool accepts(Iterator first, Iterator last)
+	{
+		Index state = visit(m_Initial.data());
+
+		for (; first != last; ++first)
+		{
+			Index symbol = m_SymbolIndex[static_cast<Symbol>(*first)]; if (symbol == NONE) return false;
+
+			Index target = m_Transitions[state * m_Width + symbol];
+			if (target == UNKNOWN)
+			{
+				const uint64_t *key = m_States.at(state);
+				m_A.step(key, symbol, m_Key.data()); m_B.step(key + m_A.m_Words, symbol, m_Key.data() + m_A.m_Words);
+
+				size_t flushesOld = m_Flushes; target = is_dead(m_Key.data()) ? NONE : visit(m_Key.data());
+				if (m_Flushes == flushesOld) m_Transitions[state * m_Width + symbol] = target;
+			}
+
+			if (target == NONE) return false;
+			state = target;
+		}
+
+		return m_FinalStates[state];
+	}
+
+	/**
+	 * @brief Check whether a word is accepted.
+	 *
+	 * @param word The word.
+	 * @return bool True if the word is accepted.
+	 */
+	bool accepts(const string& word) { return accepts(word.begin(), word.end()); }
+
+	/**
+	 * @brief Get the number of cached states.
+	 *
+	 * @return Index The number of cached states.
+	 */
+	Index size() const { return m_States.size(); }
+
+	/**
+	 * @brief Get the most states the cache holds before it is flushed.
+	 *
+	 * @return Index The capacity of the cache.
+	 */
+	Index capacity() const { return m_Capacity; }
+
+	/**
+	 * @brief Get the number of times the cache was flushed.
+	 *
+	 * @return size_t The number of flushes.
+	 */
+	size_t flushes() const { return m_Flushes; }
+
+  private:
+	static constexpr Index UNKNOWN = NONE - 1; // Transition not computed yet
+
+	size_t m_Width; bool m_Type; Index m_SymbolIndex[256];
+	SubsetTargets m_A, m_B; vector<uint64_t> m_Initial, m_Key; // Keys are the subset of A followed by the subset of B
+	SubsetTable m_States; vector<Index> m_Transitions; vector<bool> m_FinalStates; Index m_Capacity, m_Reserved; size_t m_Flushes;
+
+	/**
+	 * @brief Construct a new LazyMatcher object, compiling both NFAs over the union of their alphabets.
+	 *
+	 * @param a The first NFA.
+	 * @param b The second NFA.
+	 * @param type True for unification, false for intersection.
+	 * @param memory The memory budget of the operands and the cache in bytes.
+	 * @param alphabet The union of the alphabets of both NFAs.
+	 */
+	LazyMatcher(const NFA& a, const NFA& b, bool type, size_t memory, const set<Symbol>& alphabet)
+		: m_Width(alphabet.size()), m_Type(type),
+		  m_A(compile(a, alphabet)), m_B(compile(b, alphabet)), m_Key(m_A.m_Words + m_B.m_Words), m_States(m_A.m_Words + m_B.m_Words), m_Reserved(0), m_Flushes(0)
+	{
+		fill(begin(m_SymbolIndex), end(m_SymbolIndex), NONE); { Index tmp = 0; for (const auto& c : alphabet) m_SymbolIndex[c] = tmp++; }
+		m_Initial = m_A.m_InitialState; m_Initial.insert(m_Initial.end(), m_B.m_InitialState.begin(), m_B.m_InitialState.end());
+
+		// The operands and keys take their share of the budget first. A cached state costs its key, fingerprint, transitions and
+		// final flag, on top of the slots of the table. The cache holds one state over its capacity just before it is flushed,
+		// so pick the table size leaving room for the most states
+		size_t memoryFixed = m_A.get_memory() + m_B.get_memory() + (m_Initial.size() + m_Key.size()) * sizeof(uint64_t);
+		size_t memoryCache = memory > memoryFixed ? memory - memoryFixed : 0;
+		size_t stateMemory = m_Key.size() * sizeof(uint64_t) + sizeof(uint64_t) + m_Width * sizeof(Index) + 1, capacity = 2;
+		for (size_t slots = SubsetTable::get_slots(0); slots * sizeof(Index) < memoryCache; slots *= 2)
+		{
+			size_t states = min(slots / 2, (memoryCache - slots * sizeof(Index)) / stateMemory);
+			if (states > capacity + 1) capacity = states - 1;
+		}
+		m_Capacity = min<size_t>(capacity, UNKNOWN / max<size_t>(m_Width, 1));
+	}
+
+	/**
+	 * @brief Get the union of the alphabets of two NFAs.
+	 *
+	 * @param a The first NFA.
+	 * @param b The second NFA.
+	 * @return set<Symbol> The union of their alphabets.
+	 */
+	static set<Symbol> get_alphabet(const NFA& a, const NFA& b)
+	{
+		set<Symbol> alphabet = a.m_Alphabet; alphabet.insert(b.m_Alphabet.begin(), b.m_Alphabet.end());
+		return alphabet;
+	}
+
+	/**
+	 * @brief Check whether a state is dead, that is its subset of A, or of B, or of both, is empty.
+	 *
+	 * @param key The key of the state.
+	 * @return bool True if the state is dead.
+	 */
+	bool is_dead(const uint64_t *key) const
+	{
+		bool deadA = all_of(key, key + m_A.m_Words, [](uint64_t w) { return !w; });
+		bool deadB = all_of(key + m_A.m_Words, key + m_Key.size(), [](uint64_t w) { return !w; });
+		return m_Type ? (deadA && deadB) : (deadA || deadB);
+	}
+
+	/**
+	 * @brief Find the cached state of a key, caching it first if needed, and flushing the cache when it is full.
+	 *
+	 * The storage of the cache doubles as it fills, but never beyond its capacity, and is kept over flushes.
+	 *
+	 * @param key The key of the state, not stored in the cache.
+	 * @return Index The state.
+	 */
+	Index visit(const uint64_t *key)
+	{
+		if (m_States.size() == m_Reserved)
+		{
+			m_Reserved = min<size_t>(max<size_t>(2 * m_Reserved, 16), m_Capacity + 1);
+			m_States.reserve(m_Reserved); m_Transitions.reserve(m_Reserved * m_Width); m_FinalStates.reserve(m_Reserved);
+		}
+
+		auto it = m_States.intern(key); if (!(it.second)) return it.first;
+
+		if (m_States.size() > m_Capacity)
+		{
+			m_States = SubsetTable(m_Key.size()); m_States.reserve(m_Reserved); m_Transitions.clear(); m_FinalStates.clear(); ++m_Flushes;
+			it = m_States.intern(key);
+		}
+
+		m_Transitions.resize(m_Transitions.size() + m_Width, UNKNOWN);
+		bool finalA = m_A.is_final(key), finalB = m_B.is_final(key + m_A.m_Words);
+		m_FinalStates.push_back(m_Type ? (finalA || finalB) : (finalA && finalB));
+
+		return it.first;
+	}
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// ---------------------------------------------------------------------------------------------------------------------
+
 // You may need to update this function or the sample data if your state naming strategy differs.
 bool operator==(const DFA& a, const DFA& b)
 {
@@ -371,232 +1324,479 @@ bool operator==(const DFA& a, const DFA& b)
 // ---------------------------------------------------------------------------------------------------------------------
 // ---------------------------------------------------------------------------------------------------------------------
 
+void test1()
+{
+	NFA a1{
+		{0, 1, 2, 3, 4},
+		{'a', 'b'},
+		{
+            {{0, 'a'}, {1}},
+            {{1, 'b'}, {2}},
+            {{2, 'a'}, {3}},
+            {{3, 'b'}, {4}}
+        },
+        0,
+        {4}
+	};
+	NFA a2{
+		{0, 1, 2, 3},
+		{'a', 'b'},
+		{
+					{{0, 'a'}, {0,1,2,3}}},
+					0,
+					{0,1,2,3}
+	};
+	DFA a{
+		{0, 1, 2, 3, 4, 5},
+		{'a', 'b'},
+		{
+			{{0, 'a'}, {1}},
+			{{1, 'a'}, {2}},
+			{{1, 'b'}, {3}},
+			{{2, 'a'}, {2}},
+			{{3, 'a'}, {4}},
+			{{4, 'b'}, {5}}
+		},
+		0,
+		{0, 1, 2, 5}
+	};
+	assert(unify(a1, a2) == a);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test2()
+{
+	NFA a1{
+		{0, 1, 2, 3, 4},
+		{'a', 'b'},
+		{
+            {{0, 'a'}, {1}},
+            {{1, 'b'}, {2}},
+            {{2, 'a'}, {3}},
+            {{3, 'b'}, {4}}
+        },
+        0,
+        {4}
+	};
+	NFA a2{
+		{0, 1, 2},
+		{'a', 'b'},
+		{
+			{{0, 'a'}, {0,1}},
+			{{0, 'b'}, {0}},
+			{{1, 'b'}, {2}},
+			{{2, 'a'}, {2}},
+			{{2, 'b'}, {2}}
+			},
+			0,
+			{}
+	};
+	DFA a{
+		{0, 1, 2, 3, 4},
+		{'a', 'b'},
+		{
+			{{0, 'a'}, {1}},
+			{{1, 'b'}, {2}},
+			{{2, 'a'}, {3}},
+			{{3, 'b'}, {4}}
+		},
+		0,
+		{4}
+	};
+	assert(unify(a1, a2) == a);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test3()
+{
+    NFA a1{
+        {0, 1, 2},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {0, 1}},
+            {{0, 'b'}, {0}},
+            {{1, 'a'}, {2}},
+        },
+        0,
+        {2},
+    };
+    NFA a2{
+        {0, 1, 2},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{1, 'a'}, {2}},
+            {{2, 'a'}, {2}},
+            {{2, 'b'}, {2}},
+        },
+        0,
+        {2},
+    };
+    DFA a{
+        {0, 1, 2, 3, 4},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{1, 'a'}, {2}},
+            {{2, 'a'}, {2}},
+            {{2, 'b'}, {3}},
+            {{3, 'a'}, {4}},
+            {{3, 'b'}, {3}},
+            {{4, 'a'}, {2}},
+            {{4, 'b'}, {3}},
+        },
+        0,
+        {2},
+    };
+    assert(intersect(a1, a2) == a);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test4()
+{
+    NFA b1{
+        {0, 1, 2, 3, 4},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{0, 'b'}, {2}},
+            {{2, 'a'}, {2, 3}},
+            {{2, 'b'}, {2}},
+            {{3, 'a'}, {4}},
+        },
+        0,
+        {1, 4},
+    };
+    NFA b2{
+        {0, 1, 2, 3, 4},
+        {'a', 'b'},
+        {
+            {{0, 'b'}, {1}},
+            {{1, 'a'}, {2}},
+            {{2, 'b'}, {3}},
+            {{3, 'a'}, {4}},
+            {{4, 'a'}, {4}},
+            {{4, 'b'}, {4}},
+        },
+        0,
+        {4},
+    };
+    DFA b{
+        {0, 1, 2, 3, 4, 5, 6, 7, 8},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{0, 'b'}, {2}},
+            {{2, 'a'}, {3}},
+            {{2, 'b'}, {4}},
+            {{3, 'a'}, {5}},
+            {{3, 'b'}, {6}},
+            {{4, 'a'}, {7}},
+            {{4, 'b'}, {4}},
+            {{5, 'a'}, {5}},
+            {{5, 'b'}, {4}},
+            {{6, 'a'}, {8}},
+            {{6, 'b'}, {4}},
+            {{7, 'a'}, {5}},
+            {{7, 'b'}, {4}},
+            {{8, 'a'}, {8}},
+            {{8, 'b'}, {8}},
+        },
+        0,
+        {1, 5, 8},
+    };
+    assert(unify(b1, b2) == b);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test5()
+{
+    NFA c1{
+        {0, 1, 2, 3, 4},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {1}},
+            {{0, 'b'}, {2}},
+            {{2, 'a'}, {2, 3}},
+            {{2, 'b'}, {2}},
+            {{3, 'a'}, {4}},
+        },
+        0,
+        {1, 4},
+    };
+    NFA c2{
+        {0, 1, 2},
+        {'a', 'b'},
+        {
+            {{0, 'a'}, {0}},
+            {{0, 'b'}, {0, 1}},
+            {{1, 'b'}, {2}},
+        },
+        0,
+        {2},
+    };
+    DFA c{
+        {0},
+        {'a', 'b'},
+        {},
+        0,
+        {},
+    };
+    assert(intersect(c1, c2) == c);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test6()
+{
+    NFA d1{
+        {0, 1, 2, 3},
+        {'i', 'k', 'q'},
+        {
+            {{0, 'i'}, {2}},
+            {{0, 'k'}, {1, 2, 3}},
+            {{0, 'q'}, {0, 3}},
+            {{1, 'i'}, {1}},
+            {{1, 'k'}, {0}},
+            {{1, 'q'}, {1, 2, 3}},
+            {{2, 'i'}, {0, 2}},
+            {{3, 'i'}, {3}},
+            {{3, 'k'}, {1, 2}},
+        },
+        0,
+        {2, 3},
+    };
+    NFA d2{
+        {0, 1, 2, 3},
+        {'i', 'k'},
+        {
+            {{0, 'i'}, {3}},
+            {{0, 'k'}, {1, 2, 3}},
+            {{1, 'k'}, {2}},
+            {{2, 'i'}, {0, 1, 3}},
+            {{2, 'k'}, {0, 1}},
+        },
+        0,
+        {2, 3},
+    };
+    DFA d{
+        {0, 1, 2, 3},
+        {'i', 'k', 'q'},
+        {
+            {{0, 'i'}, {1}},
+            {{0, 'k'}, {2}},
+            {{2, 'i'}, {3}},
+            {{2, 'k'}, {2}},
+            {{3, 'i'}, {1}},
+            {{3, 'k'}, {2}},
+        },
+        0,
+        {1, 2, 3},
+    };
+    assert(intersect(d1, d2) == d);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test7()
+{
+	// The last but k-th symbol is the given one, the classic blow-up of subset construction
+	auto make_suffix = [](Symbol symbol, State k)
+	{
+		NFA n {{0}, {'a', 'b'}, {{{0, 'a'}, {0}}, {{0, 'b'}, {0}}}, 0, {k + 1}};
+		n.m_Transitions[{0, symbol}].insert(1);
+		for (State s = 1; s <= k; ++s) { n.m_States.insert(s); n.m_Transitions[{s, 'a'}] = {s + 1}; n.m_Transitions[{s, 'b'}] = {s + 1}; }
+		n.m_States.insert(k + 1);
+		return n;
+	};
+	NFA e1 = make_suffix('a', 7), e2 = make_suffix('b', 9);
+
+	Pipeline pipelineUnify = Pipeline::AUTOMATIC, pipelineIntersect = Pipeline::AUTOMATIC;
+	DFA u = unify(e1, e2, pipelineUnify), i = intersect(e1, e2, pipelineIntersect);
+	assert(pipelineUnify == Pipeline::DETERMINIZE_FIRST && pipelineIntersect == Pipeline::DETERMINIZE_FIRST);
+	assert(u.m_States.size() == 257 && i.m_States.size() == 169);
+
+	pipelineUnify = pipelineIntersect = Pipeline::PRODUCT_FIRST;
+	assert(unify(e1, e2, pipelineUnify) == u && intersect(e1, e2, pipelineIntersect) == i);
+
+	NFA f1 {{0, 1}, {'a'}, {{{0, 'a'}, {1}}}, 0, {1}}, f2 {{0}, {'b'}, {{{0, 'b'}, {0}}}, 0, {0}};
+	pipelineUnify = pipelineIntersect = Pipeline::AUTOMATIC;
+	DFA fu = unify(f1, f2, pipelineUnify), fi = intersect(f1, f2, pipelineIntersect);
+	assert(pipelineUnify == Pipeline::PRODUCT_FIRST && pipelineIntersect == Pipeline::PRODUCT_FIRST);
+	assert(fu == (DFA {{0, 1, 2}, {'a', 'b'}, {{{0, 'a'}, 1}, {{0, 'b'}, 2}, {{2, 'b'}, 2}}, 0, {0, 1, 2}}));
+	assert(fi == (DFA {{0}, {'a', 'b'}, {}, 0, {}}));
+
+	pipelineUnify = pipelineIntersect = Pipeline::DETERMINIZE_FIRST;
+	assert(unify(f1, f2, pipelineUnify) == fu && intersect(f1, f2, pipelineIntersect) == fi);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test8()
+{
+	// Any state values, including the former fail state, over an alphabet much larger than the transitions
+	State top = numeric_limits<State>::max();
+	NFA g1 {{9999, top}, {}, {{{9999, 'x'}, {top}}, {{top, 'y'}, {9999}}}, 9999, {top}};
+	NFA g2 {{0, 9999}, {}, {{{0, 'x'}, {9999}}, {{9999, 'z'}, {0, 9999}}}, 0, {9999}};
+	for (Symbol a = 'a'; a <= 'z'; ++a) { g1.m_Alphabet.insert(a); g2.m_Alphabet.insert(a); }
+
+	DFA u = unify(g1, g2), i = intersect(g1, g2);
+	assert(u.m_Alphabet.size() == 26 && i.m_Alphabet.size() == 26);
+	assert(u == (DFA {{0, 1, 2, 3, 4, 5}, u.m_Alphabet, {{{0, 'x'}, 1}, {{1, 'y'}, 2}, {{1, 'z'}, 3}, {{2, 'x'}, 4}, {{3, 'x'}, 5}, {{3, 'z'}, 3}, {{4, 'y'}, 2}, {{5, 'z'}, 3}}, 0, {1, 3, 4, 5}}));
+	assert(i == (DFA {{0, 1}, i.m_Alphabet, {{{0, 'x'}, 1}}, 0, {1}}));
+
+	// Only the rows of the transitions taken are stored for the subset construction
+	SubsetSuccessors successors(compile(g2, g2.m_Alphabet));
+	assert(successors.m_Symbols.size() == 2 && successors.m_Successors.size() == 2 * successors.m_Words);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test9()
+{
+	auto to_nfa = [](const DFA& d)
+	{
+		NFA n {d.m_States, d.m_Alphabet, {}, d.m_InitialState, d.m_FinalStates};
+		for (const auto& t : d.m_Transitions) n.m_Transitions[t.first] = {t.second};
+		return n;
+	};
+	// Words containing the given symbol, and words of length divisible by k: the intersection has a state per (nonempty set of
+	// symbols seen, length modulo 6), plus the initial one
+	auto make_containing = [](Symbol symbol)
+	{
+		NFA n {{0, 1}, {'a', 'b', 'c'}, {}, 0, {1}};
+		for (Symbol a : n.m_Alphabet) { n.m_Transitions[{0, a}] = {0}; n.m_Transitions[{1, a}] = {1}; }
+		n.m_Transitions[{0, symbol}].insert(1);
+		return n;
+	};
+	auto make_modulo = [](State k)
+	{
+		NFA n {{}, {'a', 'b', 'c'}, {}, 0, {0}};
+		for (State s = 0; s < k; ++s) { n.m_States.insert(s); for (Symbol a : n.m_Alphabet) n.m_Transitions[{s, a}] = {(s + 1) % k}; }
+		return n;
+	};
+
+	vector<NFA> automata = {make_containing('a'), make_modulo(2), make_containing('b'), make_modulo(3), make_containing('c')};
+	DFA u = unify(automata[0], automata[1]), i = intersect(automata[0], automata[1]);
+	for (size_t k = 2; k < automata.size(); ++k) { u = unify(to_nfa(u), automata[k]); i = intersect(to_nfa(i), automata[k]); }
+
+	for (size_t threads : {1, 4})
+	{
+		assert(unify(automata, threads) == u && intersect(automata, threads) == i);
+		assert(intersect({automata[0]}, threads) == unify({automata[0]}, threads));
+	}
+	assert(i.m_States.size() == 43 && u == (DFA {{0}, {'a', 'b', 'c'}, {{{0, 'a'}, 0}, {{0, 'b'}, 0}, {{0, 'c'}, 0}}, 0, {0}}));
+
+	// An empty operand short-circuits the intersection
+	automata.push_back(NFA {{0}, {'d'}, {}, 0, {}});
+	assert(intersect(automata, 4) == (DFA {{0}, {'a', 'b', 'c', 'd'}, {}, 0, {}}));
+
+	try { unify(vector<NFA>()); assert("Missing an exception" == nullptr); }
+	catch (const invalid_argument&) {}
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test10()
+{
+	auto same = [](const CompiledDFA& a, const CompiledDFA& b)
+	{ return tie(a.m_Alphabet, a.m_StatesCount, a.m_Transitions, a.m_InitialState, a.m_FinalStates) == tie(b.m_Alphabet, b.m_StatesCount, b.m_Transitions, b.m_InitialState, b.m_FinalStates); };
+
+	// The last but 12th symbol is an 'a', or the word has an 'a' at every third position
+	NFA h1 {{0}, {'a', 'b'}, {{{0, 'a'}, {0, 1}}, {{0, 'b'}, {0}}}, 0, {13}}, h2 {{0, 1, 2}, {'a', 'b'}, {{{0, 'a'}, {1}}, {{1, 'a'}, {2}}, {{1, 'b'}, {2}}, {{2, 'a'}, {0}}, {{2, 'b'}, {0}}}, 0, {0, 1, 2}};
+	for (State s = 1; s <= 12; ++s) { h1.m_States.insert(s + 1); h1.m_Transitions[{s, 'a'}] = {s + 1}; h1.m_Transitions[{s, 'b'}] = {s + 1}; }
+	for (int i = 0; i < 40; ++i) { h2.m_States.insert(i + 3); h2.m_Transitions[{i + 3, 'a'}] = {State(i % 3)}; }
+	set<Symbol> alphabet = {'a', 'b'};
+	CompiledNFA n1 = compile(h1, alphabet), n2 = compile(h2, alphabet);
+
+	CompiledDFA d1 = make_determined(n1, 1), d2 = make_determined(n2, 1);
+	assert(d1.m_StatesCount == 1 << 12 && same(make_determined(n1, 4), d1) && same(make_determined(n2, 4), d2));
+
+	CompiledDFA m1 = make_minimized(d1), m2 = make_minimized(d2);
+	for (bool type : {true, false})
+	{
+		CompiledDFA p = make_product(m1, m2, type, 1);
+		assert(p.m_StatesCount == (type ? 5012 : 916) && same(make_product(m1, m2, type, 4), p));
+		assert(same(make_determined(make_parallel_run(n1, n2, type), 4), make_determined(make_parallel_run(n1, n2, type), 1)));
+	}
+
+	// A counter up to 10000 goes parallel past PARALLEL_STATES, and an exception in any thread reaches the caller
+	auto counting = [](uint64_t failing)
+	{
+		return [failing](const uint64_t *key, uint64_t *successors)
+		{
+			if (*key == failing) throw runtime_error("");
+			*successors = *key < 10000 ? *key + 1 : 0; return *key % 2 == 0;
+		};
+	};
+	uint64_t initial = 1;
+	CompiledDFA counter = make_explored({'a'}, 1, &initial, counting(0), 1);
+	assert(counter.m_StatesCount == 10000 && same(make_explored({'a'}, 1, &initial, counting(0), 4), counter));
+	for (size_t threads : {1, 4})
+	{
+		for (uint64_t failing : {100, 8000})
+		{
+			try { make_explored({'a'}, 1, &initial, counting(failing), threads); assert("Missing an exception" == nullptr); }
+			catch (const runtime_error&) {}
+		}
+		try { run_parallel(8, [](size_t i) { if (i == 3) throw runtime_error(""); }, threads); assert("Missing an exception" == nullptr); }
+		catch (const runtime_error&) {}
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void test11()
+{
+	auto accepts = [](const DFA& d, const string& word)
+	{
+		State s = d.m_InitialState;
+		for (char c : word) { auto it = d.m_Transitions.find({s, static_cast<Symbol>(c)}); if (it == d.m_Transitions.end()) return false; s = it->second; }
+		return d.m_FinalStates.count(s) > 0;
+	};
+
+	// The last but 10th symbol is an 'a', and the last but 7th one is a 'b' (or ends with "ab")
+	NFA l1 {{0}, {'a', 'b'}, {{{0, 'a'}, {0, 1}}, {{0, 'b'}, {0}}}, 0, {11}}, l2 {{0, 1, 2}, {'a', 'b', 'c'}, {{{0, 'a'}, {0, 1}}, {{0, 'b'}, {0}}, {{0, 'c'}, {0}}, {{1, 'b'}, {2}}}, 0, {2}};
+	for (State s = 1; s <= 10; ++s) { l1.m_States.insert(s + 1); l1.m_Transitions[{s, 'a'}] = {s + 1}; l1.m_Transitions[{s, 'b'}] = {s + 1}; }
+	DFA u = unify(l1, l2), i = intersect(l1, l2), d = unify(l1, NFA {{0}, {'a'}, {}, 0, {}});
+
+	LazyMatcher matcherUnify(l1, l2, true), matcherIntersect(l1, l2, false, 2048), matcherSingle(l1, 64);
+	uint32_t seed = 1;
+	for (int w = 0; w < 2000; ++w)
+	{
+		string word; seed = seed * 1103515245 + 12345;
+		for (uint32_t length = seed >> 24 & 31, bits = seed; length; --length, bits = bits * 69069 + 1) word += "abc"[(bits >> 16) % (w % 7 ? 2 : 3)];
+
+		assert(matcherUnify.accepts(word) == accepts(u, word));
+		assert(matcherIntersect.accepts(word) == accepts(i, word));
+		assert(matcherSingle.accepts(word) == accepts(d, word));
+		assert(matcherIntersect.size() <= matcherIntersect.capacity() && matcherSingle.size() <= matcherSingle.capacity());
+	}
+	assert(!(matcherUnify.accepts(string("abx"))) && matcherUnify.accepts(string("ab")) && !(matcherIntersect.accepts(string(""))));
+	assert(matcherUnify.flushes() == 0 && matcherIntersect.flushes() > 0 && matcherSingle.flushes() > 0);
+	// The operands take 359 of the 2048 bytes, leaving room for 32 states of 37 bytes and 64 slots; 64 bytes get the least capacity
+	assert(matcherIntersect.capacity() == 31 && matcherSingle.capacity() == 2);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
 int main()
 {
-//	NFA a1{
-//		{0, 1, 2, 3, 4},
-//		{'a', 'b'},
-//		{
-//            {{0, 'a'}, {1}},
-//            {{1, 'b'}, {2}},
-//            {{2, 'a'}, {3}},
-//            {{3, 'b'}, {4}}
-//        },
-//        0,
-//        {4}
-//	};
-//	NFA a2{
-//		{0, 1, 2, 3},
-//		{'a', 'b'},
-//		{
-//					{{0, 'a'}, {0,1,2,3}}},
-//					0,
-//					{0,1,2,3}
-//	};
-//	DFA a = unify(a1, a2);
-//	assert(1);
-
-//	NFA a1{
-//		{0, 1, 2, 3, 4},
-//		{'a', 'b'},
-//		{
-//            {{0, 'a'}, {1}},
-//            {{1, 'b'}, {2}},
-//            {{2, 'a'}, {3}},
-//            {{3, 'b'}, {4}}
-//        },
-//        0,
-//        {4}
-//	};
-//	NFA a2{
-//		{0, 1, 2},
-//		{'a', 'b'},
-//		{
-//			{{0, 'a'}, {0,1}},
-//			{{0, 'b'}, {0}},
-//			{{1, 'b'}, {2}},
-//			{{2, 'a'}, {2}},
-//			{{2, 'b'}, {2}}
-//			},
-//			0,
-//			{}
-//	};
-//	DFA a = unify(a1, a2);
-//	assert(1);
-
-//    NFA a1{
-//        {0, 1, 2},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {0, 1}},
-//            {{0, 'b'}, {0}},
-//            {{1, 'a'}, {2}},
-//        },
-//        0,
-//        {2},
-//    };
-//    NFA a2{
-//        {0, 1, 2},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {1}},
-//            {{1, 'a'}, {2}},
-//            {{2, 'a'}, {2}},
-//            {{2, 'b'}, {2}},
-//        },
-//        0,
-//        {2},
-//    };
-//    DFA a{
-//        {0, 1, 2, 3, 4},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {1}},
-//            {{1, 'a'}, {2}},
-//            {{2, 'a'}, {2}},
-//            {{2, 'b'}, {3}},
-//            {{3, 'a'}, {4}},
-//            {{3, 'b'}, {3}},
-//            {{4, 'a'}, {2}},
-//            {{4, 'b'}, {3}},
-//        },
-//        0,
-//        {2},
-//    };
-//    assert(intersect(a1, a2) == a);
-
-//    NFA b1{
-//        {0, 1, 2, 3, 4},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {1}},
-//            {{0, 'b'}, {2}},
-//            {{2, 'a'}, {2, 3}},
-//            {{2, 'b'}, {2}},
-//            {{3, 'a'}, {4}},
-//        },
-//        0,
-//        {1, 4},
-//    };
-//    NFA b2{
-//        {0, 1, 2, 3, 4},
-//        {'a', 'b'},
-//        {
-//            {{0, 'b'}, {1}},
-//            {{1, 'a'}, {2}},
-//            {{2, 'b'}, {3}},
-//            {{3, 'a'}, {4}},
-//            {{4, 'a'}, {4}},
-//            {{4, 'b'}, {4}},
-//        },
-//        0,
-//        {4},
-//    };
-//    DFA b{
-//        {0, 1, 2, 3, 4, 5, 6, 7, 8},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {1}},
-//            {{0, 'b'}, {2}},
-//            {{2, 'a'}, {3}},
-//            {{2, 'b'}, {4}},
-//            {{3, 'a'}, {5}},
-//            {{3, 'b'}, {6}},
-//            {{4, 'a'}, {7}},
-//            {{4, 'b'}, {4}},
-//            {{5, 'a'}, {5}},
-//            {{5, 'b'}, {4}},
-//            {{6, 'a'}, {8}},
-//            {{6, 'b'}, {4}},
-//            {{7, 'a'}, {5}},
-//            {{7, 'b'}, {4}},
-//            {{8, 'a'}, {8}},
-//            {{8, 'b'}, {8}},
-//        },
-//        0,
-//        {1, 5, 8},
-//    };
-//    assert(unify(b1, b2) == b);
-
-//    NFA c1{
-//        {0, 1, 2, 3, 4},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {1}},
-//            {{0, 'b'}, {2}},
-//            {{2, 'a'}, {2, 3}},
-//            {{2, 'b'}, {2}},
-//            {{3, 'a'}, {4}},
-//        },
-//        0,
-//        {1, 4},
-//    };
-//    NFA c2{
-//        {0, 1, 2},
-//        {'a', 'b'},
-//        {
-//            {{0, 'a'}, {0}},
-//            {{0, 'b'}, {0, 1}},
-//            {{1, 'b'}, {2}},
-//        },
-//        0,
-//        {2},
-//    };
-//    DFA c{
-//        {0},
-//        {'a', 'b'},
-//        {},
-//        0,
-//        {},
-//    };
-//    assert(intersect(c1, c2) == c);
-
-//    NFA d1{
-//        {0, 1, 2, 3},
-//        {'i', 'k', 'q'},
-//        {
-//            {{0, 'i'}, {2}},
-//            {{0, 'k'}, {1, 2, 3}},
-//            {{0, 'q'}, {0, 3}},
-//            {{1, 'i'}, {1}},
-//            {{1, 'k'}, {0}},
-//            {{1, 'q'}, {1, 2, 3}},
-//            {{2, 'i'}, {0, 2}},
-//            {{3, 'i'}, {3}},
-//            {{3, 'k'}, {1, 2}},
-//        },
-//        0,
-//        {2, 3},
-//    };
-//    NFA d2{
-//        {0, 1, 2, 3},
-//        {'i', 'k'},
-//        {
-//            {{0, 'i'}, {3}},
-//            {{0, 'k'}, {1, 2, 3}},
-//            {{1, 'k'}, {2}},
-//            {{2, 'i'}, {0, 1, 3}},
-//            {{2, 'k'}, {0, 1}},
-//        },
-//        0,
-//        {2, 3},
-//    };
-//    DFA d{
-//        {0, 1, 2, 3},
-//        {'i', 'k', 'q'},
-//        {
-//            {{0, 'i'}, {1}},
-//            {{0, 'k'}, {2}},
-//            {{2, 'i'}, {3}},
-//            {{2, 'k'}, {2}},
-//            {{3, 'i'}, {1}},
-//            {{3, 'k'}, {2}},
-//        },
-//        0,
-//        {1, 2, 3},
-//    };
-//	DFA d3 = intersect(d1,d2);
-//    assert(intersect(d1, d2) == d);
+	test1();
+	test2();
+	test3();
+	test4();
+	test5();
+	test6();
+	test7();
+	test8();
+	test9();
+	test10();
+	test11();
 
 	return 0;
 }